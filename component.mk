@@ -27,6 +27,46 @@ ifdef WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL
 wifi_config_CFLAGS += -DWIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL=$(WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL)
 endif
 
+ifdef WIFI_CONFIG_CONNECT_BACKOFF_MIN
+wifi_config_CFLAGS += -DWIFI_CONFIG_CONNECT_BACKOFF_MIN=$(WIFI_CONFIG_CONNECT_BACKOFF_MIN)
+endif
+
+ifdef WIFI_CONFIG_CONNECT_BACKOFF_MAX
+wifi_config_CFLAGS += -DWIFI_CONFIG_CONNECT_BACKOFF_MAX=$(WIFI_CONFIG_CONNECT_BACKOFF_MAX)
+endif
+
+ifdef WIFI_CONFIG_PORTAL_GRACE
+wifi_config_CFLAGS += -DWIFI_CONFIG_PORTAL_GRACE=$(WIFI_CONFIG_PORTAL_GRACE)
+endif
+
+ifdef WIFI_CONFIG_LOG_LEVEL
+wifi_config_CFLAGS += -DWIFI_CONFIG_LOG_LEVEL=$(WIFI_CONFIG_LOG_LEVEL)
+endif
+
+ifdef WIFI_CONFIG_TRACE
+wifi_config_CFLAGS += -DWIFI_CONFIG_TRACE
+endif
+
+ifdef WIFI_CONFIG_OTA
+wifi_config_CFLAGS += -DWIFI_CONFIG_OTA
+endif
+
+ifdef WIFI_CONFIG_OTA_TOKEN
+wifi_config_CFLAGS += -DWIFI_CONFIG_OTA_TOKEN=\"$(WIFI_CONFIG_OTA_TOKEN)\"
+endif
+
+ifdef WIFI_CONFIG_LIVENESS
+wifi_config_CFLAGS += -DWIFI_CONFIG_LIVENESS
+endif
+
+ifdef WIFI_CONFIG_NO_ROAMING
+wifi_config_CFLAGS += -DWIFI_CONFIG_NO_ROAMING
+endif
+
+ifdef WIFI_CONFIG_ROAM_RSSI_THRESHOLD
+wifi_config_CFLAGS += -DWIFI_CONFIG_ROAM_RSSI_THRESHOLD=$(WIFI_CONFIG_ROAM_RSSI_THRESHOLD)
+endif
+
 ifndef WIFI_CONFIG_INDEX_HTML
 WIFI_CONFIG_INDEX_HTML = $(wifi_config_ROOT)/content/index.html
 endif
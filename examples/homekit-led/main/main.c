@@ -34,7 +34,6 @@
 // GPIO-definities
 #define LED_GPIO CONFIG_ESP_LED_GPIO
 #define BUTTON_GPIO CONFIG_ESP_BUTTON_GPIO
-#define DEBOUNCE_TIME_MS 50
 
 static const char *TAG = "main";
 
@@ -49,30 +48,17 @@ void gpio_init() {
         gpio_reset_pin(LED_GPIO);
         gpio_set_direction(LED_GPIO, GPIO_MODE_OUTPUT);
         led_write(led_on);
-
-        // Knop setup
-        gpio_config_t io_conf = {
-                .pin_bit_mask = 1ULL << BUTTON_GPIO,
-                        .mode = GPIO_MODE_INPUT,
-                        .pull_up_en = GPIO_PULLUP_ENABLE,
-                        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-                        .intr_type = GPIO_INTR_DISABLE
-        };
-        gpio_config(&io_conf);
 }
 
-// Task voor knopdetectie
-void button_task(void *pvParameter) {
-    ESP_LOGI(TAG, "Button task started");
-    while (1) {
-        bool state = gpio_get_level(BUTTON_GPIO);
-        ESP_LOGI(TAG, "Button GPIO level: %d", state);
-        if (!state) {
-            ESP_LOGW(TAG, "BUTTON PRESSED → RESET WIFI");
-            wifi_config_reset();  // bevat al een esp_restart()
-        }
-        vTaskDelay(pdMS_TO_TICKS(500));
-    }
+// Knop: kort drukken opent het portaal, lang drukken wist het netwerk
+void button_init() {
+        wifi_config_button_config_t button_config = {
+                .gpio = BUTTON_GPIO,
+                .short_press = WIFI_CONFIG_BUTTON_PORTAL,
+                .long_press = WIFI_CONFIG_BUTTON_RESET,
+        };
+        if (wifi_config_button_init(&button_config))
+                ESP_LOGE(TAG, "Button setup failed");
 }
 
 // Accessory identify
@@ -160,6 +146,6 @@ void on_wifi_ready() {
 void app_main(void) {
         ESP_ERROR_CHECK(nvs_flash_init());
         gpio_init();
-        xTaskCreate(button_task, "button_task", 2048, NULL, 10, NULL);
         wifi_config_init(DEVICE_NAME, NULL, on_wifi_ready);
+        button_init();
 }
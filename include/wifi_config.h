@@ -1,17 +1,109 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 typedef enum {
         WIFI_CONFIG_CONNECTED = 1,
         WIFI_CONFIG_DISCONNECTED = 2,
+        // Only delivered to listeners added with wifi_config_subscribe()
+        WIFI_CONFIG_AP_CLIENT_JOINED = 3,
+        WIFI_CONFIG_AP_CLIENT_LEFT = 4,
+        WIFI_CONFIG_CREDENTIALS_RECEIVED = 5,
 } wifi_config_event_t;
 
+typedef struct {
+        wifi_config_event_t event;
+        union {
+                // WIFI_CONFIG_CONNECTED, addresses in network byte order
+                struct {
+                        uint32_t ip;
+                        uint32_t netmask;
+                        uint32_t gateway;
+                } connected;
+                // WIFI_CONFIG_DISCONNECTED, the last WIFI_REASON_* code
+                struct {
+                        uint8_t reason;
+                } disconnected;
+                // WIFI_CONFIG_AP_CLIENT_JOINED and WIFI_CONFIG_AP_CLIENT_LEFT
+                struct {
+                        uint8_t mac[6];
+                } ap_client;
+                // WIFI_CONFIG_CREDENTIALS_RECEIVED, before they are tried
+                struct {
+                        char ssid[33];
+                } credentials;
+        };
+} wifi_config_event_info_t;
+
+typedef void (*wifi_config_listener_t)(const wifi_config_event_info_t *info, void *arg);
+
 void wifi_config_init(const char *ssid_prefix, const char *password, void (*on_wifi_ready)());
 void wifi_config_init2(const char *ssid_prefix, const char *password, void (*on_event)(wifi_config_event_t));
 
+// Stops the portal and monitor and frees everything allocated by wifi_config_init*().
+// Must not be called from an event callback or listener.
+void wifi_config_deinit();
+
+// Events are delivered from a dedicated task (WIFI_CONFIG_EVENT_TASK_PRIORITY),
+// so listeners may block without stalling WiFi handling or system timers.
+// Up to WIFI_CONFIG_MAX_LISTENERS listeners, returns 0 on success.
+int wifi_config_subscribe(wifi_config_listener_t listener, void *arg);
+void wifi_config_unsubscribe(wifi_config_listener_t listener, void *arg);
+
 void wifi_config_reset();
 void wifi_config_get(char **ssid, char **password);
+// Saves a network that uses DHCP, see wifi_config_set_static_ip()
 void wifi_config_set(const char *ssid, const char *password);
+// Static addressing for the saved network as "ip,netmask,gateway[,dns]",
+// NULL or "" for DHCP. Returns 0 on success, -1 if it can't be parsed.
+int wifi_config_set_static_ip(const char *static_ip);
+// Reads an extra key stored by POST /provision; *value is NULL if unset.
+// The caller frees *value.
+void wifi_config_get_extra(const char *key, char **value);
 
 void wifi_config_set_custom_html(char *html);
 
+// Raises the portal next to a working connection, e.g. to move the device
+// to another network. It stays up for WIFI_CONFIG_PORTAL_OPEN_TIME ms
+// (5 min) or until credentials entered there connected.
+void wifi_config_portal_open();
+
+// What a button press does, see wifi_config_button_init()
+typedef enum {
+        WIFI_CONFIG_BUTTON_NONE = 0,
+        WIFI_CONFIG_BUTTON_RESTART,       // esp_restart()
+        WIFI_CONFIG_BUTTON_PORTAL,        // wifi_config_portal_open()
+        WIFI_CONFIG_BUTTON_RESET,         // wifi_config_reset(), then restart into the portal
+} wifi_config_button_action_t;
+
+typedef struct {
+        int gpio;
+        // Pressed reads high with a pull-down, otherwise low with a pull-up
+        bool active_high;
+        // Held this long (ms) for a long press, 0 for
+        // WIFI_CONFIG_BUTTON_LONG_PRESS_TIME (5 s)
+        uint32_t long_press_time;
+        wifi_config_button_action_t short_press;
+        wifi_config_button_action_t long_press;
+        // Optional, called before the action from the esp_timer task
+        void (*on_press)(bool long_press, void *arg);
+        void *arg;
+} wifi_config_button_config_t;
+
+// Watches one button through a GPIO interrupt debounced with an esp_timer,
+// without a task or polling. A long press fires while the button is still
+// held. Returns 0 on success.
+int wifi_config_button_init(const wifi_config_button_config_t *config);
+void wifi_config_button_deinit();
+
+// Formats the portal and link metrics in the Prometheus text format. Works
+// like snprintf(): returns the full length, which may exceed size.
+size_t wifi_config_metrics_format(char *buffer, size_t size);
+
+// Prints the trace ring as hex lines between "WCTRACE BEGIN" and
+// "WCTRACE END" (needs WIFI_CONFIG_TRACE). See tools/trace_to_chrome.py.
+void wifi_config_trace_dump();
+
 esp_err_t safe_set_auto_connect(bool enable);
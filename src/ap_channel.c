@@ -0,0 +1,65 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stddef.h>
+#include <string.h>
+#include "ap_channel.h"
+
+// Channels 5 MHz apart overlap for four steps either side
+#define OVERLAP_STEPS 4
+// Signals at or below this floor add the minimum weight
+#define RSSI_FLOOR -95
+
+
+void ap_channel_load_reset(ap_channel_load_t *load) {
+        memset(load, 0, sizeof(*load));
+}
+
+
+void ap_channel_load_add(ap_channel_load_t *load, uint8_t channel, int8_t rssi) {
+        if (channel < 1 || channel > AP_CHANNEL_MAX)
+                return;
+
+        // A BSS at -45 dBm weighs about ten times one at -90 dBm
+        uint32_t weight = rssi > RSSI_FLOOR ? rssi - RSSI_FLOOR : 1;
+
+        for (int c = channel - OVERLAP_STEPS; c <= channel + OVERLAP_STEPS; c++) {
+                if (c < 1 || c > AP_CHANNEL_MAX)
+                        continue;
+
+                int distance = c > channel ? c - channel : channel - c;
+                load->load[c] += weight * (OVERLAP_STEPS + 1 - distance);
+        }
+}
+
+
+uint8_t ap_channel_load_best(const ap_channel_load_t *load) {
+        static const uint8_t candidates[] = { 1, 6, 11 };
+
+        uint8_t best = candidates[0];
+        for (size_t i = 1; i < sizeof(candidates); i++) {
+                if (load->load[candidates[i]] < load->load[best])
+                        best = candidates[i];
+        }
+        return best;
+}
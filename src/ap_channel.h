@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+// SoftAP channel choice from scan results, kept free of ESP-IDF calls so it
+// can be exercised on the host. RSSI in dBm, 2.4 GHz channels 1-13.
+
+#define AP_CHANNEL_MAX 13
+
+typedef struct {
+        uint32_t load[AP_CHANNEL_MAX + 1];
+} ap_channel_load_t;
+
+void ap_channel_load_reset(ap_channel_load_t *load);
+
+// Counts a BSS seen on the given primary channel against that channel and
+// the neighbours its 20 MHz signal overlaps, weighted by how strong it is
+void ap_channel_load_add(ap_channel_load_t *load, uint8_t channel, int8_t rssi);
+
+// Least loaded of the non-overlapping channels 1, 6 and 11, the lowest
+// channel on a tie
+uint8_t ap_channel_load_best(const ap_channel_load_t *load);
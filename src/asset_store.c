@@ -0,0 +1,200 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <esp_partition.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "asset_store.h"
+
+#ifdef ESP_PLATFORM
+#include "async_log.h"
+#define ERROR(message, ...) ASYNC_LOG(ASYNC_LOG_ERROR, "!!! asset_store: " message "\n", ## __VA_ARGS__)
+#else
+#define ERROR(message, ...) printf("!!! asset_store: " message "\n", ## __VA_ARGS__)
+#endif
+
+
+static const uint8_t *asset_image = NULL;
+static size_t asset_image_size = 0;
+
+#ifdef ESP_PLATFORM
+static esp_partition_mmap_handle_t asset_mmap_handle;
+#endif
+
+
+static const asset_store_entry_t *asset_store_entries() {
+        return (const asset_store_entry_t *) (asset_image + sizeof(asset_store_header_t));
+}
+
+
+static bool asset_store_range_valid(uint32_t offset, uint32_t length, size_t size) {
+        return offset <= size && length <= size - offset;
+}
+
+
+// Checks every offset once, so lookups can trust the image afterwards
+static bool asset_store_validate(const uint8_t *image, size_t size) {
+        if (size < sizeof(asset_store_header_t))
+                return false;
+
+        const asset_store_header_t *header = (const asset_store_header_t *) image;
+        if (header->magic != ASSET_STORE_MAGIC || header->version != ASSET_STORE_VERSION)
+                return false;
+        if (header->size > size)
+                return false;
+
+        size = header->size;
+        if (!asset_store_range_valid(sizeof(*header), header->count * sizeof(asset_store_entry_t), size))
+                return false;
+
+        const asset_store_entry_t *entries = (const asset_store_entry_t *) (image + sizeof(*header));
+        for (int i = 0; i < header->count; i++) {
+                const asset_store_entry_t *entry = &entries[i];
+                if (!asset_store_range_valid(entry->path_offset, entry->path_length, size) ||
+                    !asset_store_range_valid(entry->type_offset, entry->type_length, size) ||
+                    !asset_store_range_valid(entry->data_offset, entry->data_length, size))
+                        return false;
+        }
+
+        return true;
+}
+
+
+int asset_store_open(const char *name) {
+        if (asset_image)
+                return 0;
+
+        const void *image = NULL;
+        size_t size = 0;
+
+#ifdef ESP_PLATFORM
+        const esp_partition_t *partition = esp_partition_find_first(
+                ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, name);
+        if (!partition)
+                return -1;
+
+        if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA,
+                               &image, &asset_mmap_handle) != ESP_OK) {
+                ERROR("Failed to map partition %s", name);
+                return -1;
+        }
+        size = partition->size;
+#else
+        int fd = open(name, O_RDONLY);
+        if (fd < 0)
+                return -1;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                size = st.st_size;
+                image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (image == MAP_FAILED)
+                        image = NULL;
+        }
+        close(fd);
+
+        if (!image) {
+                ERROR("Failed to map %s", name);
+                return -1;
+        }
+#endif
+
+        if (!asset_store_validate(image, size)) {
+                ERROR("Invalid asset image in %s", name);
+#ifdef ESP_PLATFORM
+                esp_partition_munmap(asset_mmap_handle);
+#else
+                munmap((void *) image, size);
+#endif
+                return -1;
+        }
+
+        asset_image = image;
+        asset_image_size = size;
+
+        return 0;
+}
+
+
+void asset_store_close() {
+        if (!asset_image)
+                return;
+
+#ifdef ESP_PLATFORM
+        esp_partition_munmap(asset_mmap_handle);
+#else
+        munmap((void *) asset_image, asset_image_size);
+#endif
+
+        asset_image = NULL;
+        asset_image_size = 0;
+}
+
+
+static int asset_store_compare(const asset_store_entry_t *entry, const char *path, size_t path_length) {
+        size_t length = entry->path_length < path_length ? entry->path_length : path_length;
+        int result = memcmp(asset_image + entry->path_offset, path, length);
+        if (result)
+                return result;
+
+        return (entry->path_length > path_length) - (entry->path_length < path_length);
+}
+
+
+bool asset_store_find(const char *path, size_t path_length, asset_t *asset) {
+        if (!asset_image)
+                return false;
+
+        const asset_store_header_t *header = (const asset_store_header_t *) asset_image;
+        const asset_store_entry_t *entries = asset_store_entries();
+
+        int low = 0, high = header->count - 1;
+        while (low <= high) {
+                int middle = (low + high) / 2;
+                int result = asset_store_compare(&entries[middle], path, path_length);
+                if (result < 0) {
+                        low = middle + 1;
+                } else if (result > 0) {
+                        high = middle - 1;
+                } else {
+                        const asset_store_entry_t *entry = &entries[middle];
+                        asset->content_type = (const char *) asset_image + entry->type_offset;
+                        asset->content_type_length = entry->type_length;
+                        asset->data = asset_image + entry->data_offset;
+                        asset->length = entry->data_length;
+                        asset->etag = entry->etag;
+                        return true;
+                }
+        }
+
+        return false;
+}
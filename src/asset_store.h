@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Asset image layout, as written by tools/build_assets.py. All integers are
+// little endian and every structure is 4-byte aligned, so the image can be
+// read in place from memory mapped flash.
+//
+//   asset_store_header_t
+//   asset_store_entry_t[count]   sorted by path
+//   path and content type strings
+//   asset data
+#define ASSET_STORE_MAGIC 0x53414357 // "WCAS"
+#define ASSET_STORE_VERSION 1
+
+typedef struct {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t count;
+        uint32_t size;
+} asset_store_header_t;
+
+typedef struct {
+        uint32_t path_offset;
+        uint32_t type_offset;
+        uint32_t data_offset;
+        uint32_t data_length;
+        uint32_t etag;
+        uint16_t path_length;
+        uint16_t type_length;
+} asset_store_entry_t;
+
+typedef struct {
+        const char *content_type;
+        size_t content_type_length;
+        const uint8_t *data;
+        size_t length;
+        uint32_t etag;
+} asset_t;
+
+// Maps the asset image. On the device name is a data partition label, on the
+// host it is the path of a file holding the image.
+int asset_store_open(const char *name);
+void asset_store_close();
+
+bool asset_store_find(const char *path, size_t path_length, asset_t *asset);
@@ -0,0 +1,464 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "async_log.h"
+
+#ifndef WIFI_CONFIG_LOG_SLOTS
+#define WIFI_CONFIG_LOG_SLOTS 32
+#endif
+#ifndef WIFI_CONFIG_LOG_ARGS_SIZE
+#define WIFI_CONFIG_LOG_ARGS_SIZE 96
+#endif
+#ifndef WIFI_CONFIG_LOG_LINE_SIZE
+#define WIFI_CONFIG_LOG_LINE_SIZE 256
+#endif
+
+_Static_assert((WIFI_CONFIG_LOG_SLOTS & (WIFI_CONFIG_LOG_SLOTS - 1)) == 0,
+               "WIFI_CONFIG_LOG_SLOTS must be a power of two");
+
+
+// Bounded multi-producer queue (Vyukov): a slot is free for the producer
+// claiming position p when its sequence equals p, and holds a record for
+// the consumer when it equals p + 1. Sequences are stored minus the slot
+// index so the zero initialized ring starts out empty.
+typedef struct {
+        atomic_uint sequence;
+        const char *format;
+        uint16_t length;
+        bool truncated;
+        uint8_t args[WIFI_CONFIG_LOG_ARGS_SIZE];
+} async_log_slot_t;
+
+static async_log_slot_t log_slots[WIFI_CONFIG_LOG_SLOTS];
+static atomic_uint log_enqueue_position;
+static atomic_uint log_dequeue_position;
+static atomic_uint log_dropped;
+
+static atomic_bool log_started;
+
+#define SLOT_INDEX(position) ((position) & (WIFI_CONFIG_LOG_SLOTS - 1))
+
+static unsigned slot_sequence(async_log_slot_t *slot) {
+        return atomic_load_explicit(&slot->sequence, memory_order_acquire) + (slot - log_slots);
+}
+
+static void slot_set_sequence(async_log_slot_t *slot, unsigned sequence) {
+        atomic_store_explicit(&slot->sequence, sequence - (slot - log_slots), memory_order_release);
+}
+
+static TaskHandle_t log_task_handle = NULL;
+
+
+typedef enum {
+        ARG_INT,
+        ARG_LONG,
+        ARG_LONG_LONG,
+        ARG_SIZE,
+        ARG_INTMAX,
+        ARG_PTRDIFF,
+        ARG_DOUBLE,
+        ARG_LONG_DOUBLE,
+        ARG_POINTER,
+        ARG_STRING,
+        ARG_INVALID,
+} arg_type_t;
+
+// One conversion of a format string, e.g. "%-*.*s"
+typedef struct {
+        const char *start;
+        const char *end;
+        bool width_arg;
+        bool precision_arg;
+        int precision;
+        arg_type_t type;
+} conversion_t;
+
+
+// Finds the next conversion at or after format. Returns false at the end
+// of the string; "%%" is not a conversion.
+static bool next_conversion(const char *format, conversion_t *c) {
+        const char *f = format;
+        while (true) {
+                f = strchr(f, '%');
+                if (!f)
+                        return false;
+                if (f[1] != '%')
+                        break;
+                f += 2;
+        }
+
+        memset(c, 0, sizeof(*c));
+        c->start = f++;
+        c->precision = -1;
+
+        while (*f && strchr("-+ #0", *f))
+                f++;
+
+        if (*f == '*') {
+                c->width_arg = true;
+                f++;
+        }
+        while (*f >= '0' && *f <= '9')
+                f++;
+
+        if (*f == '.') {
+                f++;
+                c->precision = 0;
+                if (*f == '*') {
+                        c->precision_arg = true;
+                        f++;
+                }
+                while (*f >= '0' && *f <= '9')
+                        c->precision = c->precision * 10 + (*f++ - '0');
+        }
+
+        arg_type_t integer = ARG_INT;
+        switch (*f) {
+        case 'h': f++; if (*f == 'h') f++; break;
+        case 'l': f++; integer = ARG_LONG; if (*f == 'l') { f++; integer = ARG_LONG_LONG; } break;
+        case 'z': f++; integer = ARG_SIZE; break;
+        case 'j': f++; integer = ARG_INTMAX; break;
+        case 't': f++; integer = ARG_PTRDIFF; break;
+        case 'L': f++; integer = ARG_LONG_DOUBLE; break;
+        }
+
+        switch (*f) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                c->type = integer == ARG_LONG_DOUBLE ? ARG_INVALID : integer;
+                break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                c->type = integer == ARG_LONG_DOUBLE ? ARG_LONG_DOUBLE : ARG_DOUBLE;
+                break;
+        case 'p':
+                c->type = ARG_POINTER;
+                break;
+        case 's':
+                c->type = ARG_STRING;
+                break;
+        default:
+                c->type = ARG_INVALID;
+                c->end = f;
+                return true;
+        }
+
+        c->end = f + 1;
+        return true;
+}
+
+
+static size_t arg_size(arg_type_t type) {
+        switch (type) {
+        case ARG_INT: return sizeof(int);
+        case ARG_LONG: return sizeof(long);
+        case ARG_LONG_LONG: return sizeof(long long);
+        case ARG_SIZE: return sizeof(size_t);
+        case ARG_INTMAX: return sizeof(intmax_t);
+        case ARG_PTRDIFF: return sizeof(ptrdiff_t);
+        case ARG_DOUBLE: return sizeof(double);
+        case ARG_LONG_DOUBLE: return sizeof(long double);
+        case ARG_POINTER: return sizeof(void *);
+        default: return 0;
+        }
+}
+
+
+static bool slot_put(async_log_slot_t *slot, const void *data, size_t length) {
+        if (slot->length + length > sizeof(slot->args)) {
+                slot->truncated = true;
+                return false;
+        }
+        memcpy(slot->args + slot->length, data, length);
+        slot->length += length;
+        return true;
+}
+
+
+// Strings are copied since the caller may free them right after logging
+static bool slot_put_string(async_log_slot_t *slot, const char *s, int precision) {
+        if (!s)
+                s = "(null)";
+
+        size_t length = precision >= 0 ? strnlen(s, precision) : strlen(s);
+        size_t space = sizeof(slot->args) - slot->length;
+        if (!space) {
+                slot->truncated = true;
+                return false;
+        }
+        if (length >= space) {
+                length = space - 1;
+                slot->truncated = true;
+        }
+
+        memcpy(slot->args + slot->length, s, length);
+        slot->args[slot->length + length] = 0;
+        slot->length += length + 1;
+        return !slot->truncated;
+}
+
+
+static void slot_record(async_log_slot_t *slot, const char *format, va_list args) {
+        slot->format = format;
+        slot->length = 0;
+        slot->truncated = false;
+
+        conversion_t c;
+        while (next_conversion(format, &c)) {
+                format = c.end;
+                if (c.type == ARG_INVALID) {
+                        slot->truncated = true;
+                        return;
+                }
+
+                if (c.width_arg) {
+                        int width = va_arg(args, int);
+                        if (!slot_put(slot, &width, sizeof(width)))
+                                return;
+                }
+                if (c.precision_arg) {
+                        c.precision = va_arg(args, int);
+                        if (!slot_put(slot, &c.precision, sizeof(c.precision)))
+                                return;
+                }
+
+                bool stored;
+                switch (c.type) {
+                case ARG_INT: { int v = va_arg(args, int); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_LONG: { long v = va_arg(args, long); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_LONG_LONG: { long long v = va_arg(args, long long); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_SIZE: { size_t v = va_arg(args, size_t); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_INTMAX: { intmax_t v = va_arg(args, intmax_t); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_PTRDIFF: { ptrdiff_t v = va_arg(args, ptrdiff_t); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_DOUBLE: { double v = va_arg(args, double); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_LONG_DOUBLE: { long double v = va_arg(args, long double); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_POINTER: { void *v = va_arg(args, void *); stored = slot_put(slot, &v, sizeof(v)); break; }
+                case ARG_STRING: stored = slot_put_string(slot, va_arg(args, const char *), c.precision); break;
+                default: stored = false;
+                }
+                if (!stored)
+                        return;
+        }
+}
+
+
+static void log_task(void *arg);
+
+static void log_start() {
+        bool expected = false;
+        if (!atomic_compare_exchange_strong(&log_started, &expected, true))
+                return;
+
+        xTaskCreate(log_task, "wifi_config_log", 3072, NULL, tskIDLE_PRIORITY + 1, &log_task_handle);
+}
+
+
+void async_log_record(const char *format, ...) {
+        unsigned position = atomic_load_explicit(&log_enqueue_position, memory_order_relaxed);
+        async_log_slot_t *slot;
+        while (true) {
+                slot = &log_slots[SLOT_INDEX(position)];
+                unsigned sequence = slot_sequence(slot);
+                int difference = (int) (sequence - position);
+                if (difference == 0) {
+                        if (atomic_compare_exchange_weak_explicit(&log_enqueue_position, &position, position + 1,
+                                                                  memory_order_relaxed, memory_order_relaxed))
+                                break;
+                } else if (difference < 0) {
+                        // Full, the console can't keep up
+                        atomic_fetch_add_explicit(&log_dropped, 1, memory_order_relaxed);
+                        return;
+                } else {
+                        position = atomic_load_explicit(&log_enqueue_position, memory_order_relaxed);
+                }
+        }
+
+        va_list args;
+        va_start(args, format);
+        slot_record(slot, format, args);
+        va_end(args);
+
+        slot_set_sequence(slot, position + 1);
+
+        if (log_task_handle)
+                xTaskNotifyGive(log_task_handle);
+        else
+                log_start();
+}
+
+
+static size_t line_append(char *line, size_t length, const char *data, size_t data_length) {
+        if (length + data_length > WIFI_CONFIG_LOG_LINE_SIZE - 1)
+                data_length = WIFI_CONFIG_LOG_LINE_SIZE - 1 - length;
+        memcpy(line + length, data, data_length);
+        return length + data_length;
+}
+
+
+// Copies literal format text, turning "%%" into "%"
+static size_t line_append_literal(char *line, size_t length, const char *text, size_t text_length) {
+        const char *end = text + text_length;
+        while (text < end) {
+                const char *percent = memchr(text, '%', end - text);
+                if (!percent)
+                        return line_append(line, length, text, end - text);
+
+                length = line_append(line, length, text, percent - text + 1);
+                text = percent + (percent + 1 < end && percent[1] == '%' ? 2 : 1);
+        }
+        return length;
+}
+
+
+static size_t line_format(char *line, size_t length, const char *spec, size_t spec_length,
+                          arg_type_t type, const uint8_t *value) {
+        // Width and precision were recorded and are substituted into the spec
+        char format[24];
+        if (spec_length >= sizeof(format))
+                return length;
+        memcpy(format, spec, spec_length);
+        format[spec_length] = 0;
+
+        size_t space = WIFI_CONFIG_LOG_LINE_SIZE - length;
+        int n = 0;
+        switch (type) {
+        case ARG_INT: { int v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_LONG: { long v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_LONG_LONG: { long long v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_SIZE: { size_t v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_INTMAX: { intmax_t v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_PTRDIFF: { ptrdiff_t v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_DOUBLE: { double v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_LONG_DOUBLE: { long double v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_POINTER: { void *v; memcpy(&v, value, sizeof(v)); n = snprintf(line + length, space, format, v); break; }
+        case ARG_STRING: n = snprintf(line + length, space, format, (const char *) value); break;
+        default: break;
+        }
+
+        if (n < 0)
+                return length;
+        return length + n < space ? length + n : WIFI_CONFIG_LOG_LINE_SIZE - 1;
+}
+
+
+// Rebuilds a conversion spec with recorded '*' values filled in
+static size_t spec_build(char *spec, size_t size, const conversion_t *c,
+                         const uint8_t **args, const uint8_t *args_end) {
+        size_t length = 0;
+        for (const char *f = c->start; f < c->end && length < size - 12; f++) {
+                if (*f != '*') {
+                        spec[length++] = *f;
+                        continue;
+                }
+
+                int value;
+                if (*args + sizeof(value) > args_end)
+                        return 0;
+                memcpy(&value, *args, sizeof(value));
+                *args += sizeof(value);
+                length += snprintf(spec + length, size - length, "%d", value);
+        }
+        return length;
+}
+
+
+static void log_write(const async_log_slot_t *slot) {
+        char line[WIFI_CONFIG_LOG_LINE_SIZE];
+        size_t length = 0;
+
+        const char *format = slot->format;
+        const uint8_t *args = slot->args;
+        const uint8_t *args_end = slot->args + slot->length;
+
+        conversion_t c;
+        while (next_conversion(format, &c)) {
+                length = line_append_literal(line, length, format, c.start - format);
+                format = c.end;
+
+                char spec[32];
+                size_t spec_length = spec_build(spec, sizeof(spec), &c, &args, args_end);
+
+                size_t size = c.type == ARG_STRING ? strnlen((const char *) args, args_end - args) + 1 : arg_size(c.type);
+                if (!spec_length || c.type == ARG_INVALID || args + size > args_end) {
+                        format = c.start;
+                        break;
+                }
+
+                length = line_format(line, length, spec, spec_length, c.type, args);
+                args += size;
+        }
+
+        length = line_append_literal(line, length, format, strlen(format));
+
+        if (slot->truncated && length && line[length - 1] == '\n') {
+                length--;
+                length = line_append(line, length, " [...]\n", 7);
+        }
+
+        fwrite(line, 1, length, stdout);
+}
+
+
+static void log_task(void *arg) {
+        while (true) {
+                unsigned position = atomic_load_explicit(&log_dequeue_position, memory_order_relaxed);
+                while (true) {
+                        async_log_slot_t *slot = &log_slots[SLOT_INDEX(position)];
+                        if (slot_sequence(slot) != position + 1)
+                                break;
+
+                        log_write(slot);
+
+                        slot_set_sequence(slot, position + WIFI_CONFIG_LOG_SLOTS);
+                        position++;
+                        atomic_store_explicit(&log_dequeue_position, position, memory_order_relaxed);
+                }
+
+                unsigned dropped = atomic_exchange_explicit(&log_dropped, 0, memory_order_relaxed);
+                if (dropped)
+                        printf("!!! wifi_config: %u log messages dropped\n", dropped);
+
+                fflush(stdout);
+
+                ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        }
+}
+
+
+void async_log_flush(uint32_t timeout_ms) {
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(timeout_ms);
+        while (atomic_load(&log_dequeue_position) != atomic_load(&log_enqueue_position) &&
+               (int32_t) (deadline - xTaskGetTickCount()) > 0) {
+                if (log_task_handle)
+                        xTaskNotifyGive(log_task_handle);
+                vTaskDelay(pdMS_TO_TICKS(10));
+        }
+}
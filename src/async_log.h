@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Deferred logging. A log call copies its format pointer and arguments
+// (including %s strings) into a lock-free ring and returns; a low priority
+// task formats the records and writes them to the console. Callers never
+// wait on the UART. Not for use from ISRs.
+
+#define ASYNC_LOG_NONE 0
+#define ASYNC_LOG_ERROR 1
+#define ASYNC_LOG_INFO 2
+#define ASYNC_LOG_DEBUG 3
+
+#ifndef WIFI_CONFIG_LOG_LEVEL
+#ifdef WIFI_CONFIG_DEBUG
+#define WIFI_CONFIG_LOG_LEVEL ASYNC_LOG_DEBUG
+#else
+#define WIFI_CONFIG_LOG_LEVEL ASYNC_LOG_INFO
+#endif
+#endif
+
+// Calls above WIFI_CONFIG_LOG_LEVEL are removed at compile time
+#define ASYNC_LOG(level, format, ...) \
+        do { \
+                if ((level) <= WIFI_CONFIG_LOG_LEVEL) \
+                        async_log_record(format, ## __VA_ARGS__); \
+        } while (0)
+
+void async_log_record(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Waits up to timeout_ms for queued records to be written, e.g. before a restart
+void async_log_flush(uint32_t timeout_ms);
@@ -83,6 +83,8 @@ form_param_t *form_params_parse(const char *s) {
                 int pos = i;
                 while (s[i] && s[i] != '=' && s[i] != '&') i++;
                 if (i == pos) {
+                        if (!s[i])
+                                break;
                         i++;
                         continue;
                 }
@@ -0,0 +1,94 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include "liveness.h"
+
+
+void liveness_config_init(liveness_config_t *config, uint32_t detect_time, uint32_t probes_per_minute,
+                          uint32_t timeout, uint8_t max_misses) {
+        if (!max_misses)
+                max_misses = 1;
+        if (!probes_per_minute)
+                probes_per_minute = 1;
+
+        config->timeout = timeout;
+        config->max_misses = max_misses;
+
+        // Worst case: the link dies right after an answered probe, so the
+        // next probe and max_misses - 1 retries all have to fit
+        uint32_t retries = max_misses - 1;
+        uint32_t interval = 60000 / probes_per_minute;
+        uint32_t longest = detect_time > timeout * (retries + 1) ? detect_time - timeout * (retries + 1) : 0;
+        if (interval > longest)
+                interval = longest;
+        if (interval < timeout)
+                interval = timeout;
+        config->interval = interval;
+
+        if (retries && detect_time > interval + timeout) {
+                config->retry_interval = (detect_time - interval - timeout) / retries;
+        } else {
+                config->retry_interval = timeout;
+        }
+        if (config->retry_interval < timeout)
+                config->retry_interval = timeout;
+        if (config->retry_interval > interval)
+                config->retry_interval = interval;
+}
+
+
+uint32_t liveness_detect_time(const liveness_config_t *config) {
+        return config->interval + (config->max_misses - 1) * config->retry_interval + config->timeout;
+}
+
+
+void liveness_reset(liveness_state_t *state) {
+        state->misses = 0;
+        state->armed = false;
+}
+
+
+liveness_verdict_t liveness_on_result(liveness_state_t *state, const liveness_config_t *config,
+                                      bool answered, uint32_t *next_probe) {
+        if (answered) {
+                state->armed = true;
+                state->misses = 0;
+                *next_probe = config->interval - config->timeout;
+                return LIVENESS_OK;
+        }
+
+        state->misses++;
+
+        if (!state->armed) {
+                *next_probe = config->interval - config->timeout;
+                return state->misses >= config->max_misses ? LIVENESS_UNSUPPORTED : LIVENESS_SUSPECT;
+        }
+
+        if (state->misses >= config->max_misses) {
+                *next_probe = 0;
+                return LIVENESS_DEAD;
+        }
+
+        *next_probe = config->retry_interval - config->timeout;
+        return LIVENESS_SUSPECT;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Gateway liveness schedule, kept free of ESP-IDF calls so it can be
+// exercised on the host. Probes are spaced by interval while the gateway
+// answers and by retry_interval once one went unanswered, so a dead link is
+// noticed within the detection time while a healthy one costs only the
+// probe budget. Times are in milliseconds.
+
+typedef struct {
+        uint32_t interval;        // between probes while the gateway answers
+        uint32_t retry_interval;  // between probes after a miss
+        uint32_t timeout;         // a probe without answer by then is a miss
+        uint8_t max_misses;       // consecutive misses that declare the link dead
+} liveness_config_t;
+
+typedef struct {
+        uint8_t misses;
+        // Misses only count once the gateway answered at least once, so a
+        // gateway that never answers probes can't trigger reconnects
+        bool armed;
+} liveness_state_t;
+
+typedef enum {
+        LIVENESS_OK = 0,
+        LIVENESS_SUSPECT,         // missed, but not often enough yet
+        LIVENESS_DEAD,
+        LIVENESS_UNSUPPORTED,     // never answered, stop probing
+} liveness_verdict_t;
+
+// Derives the schedule from a worst case detection time and a probe budget
+// while healthy. Detection time wins: the interval is shortened if the
+// budget alone would make detection slower.
+void liveness_config_init(liveness_config_t *config, uint32_t detect_time, uint32_t probes_per_minute,
+                          uint32_t timeout, uint8_t max_misses);
+
+// Worst case time from the link dying until LIVENESS_DEAD
+uint32_t liveness_detect_time(const liveness_config_t *config);
+
+void liveness_reset(liveness_state_t *state);
+
+// Feeds the outcome of a probe, known timeout ms after it was sent. Sets
+// the delay from now until the next probe should be sent.
+liveness_verdict_t liveness_on_result(liveness_state_t *state, const liveness_config_t *config,
+                                      bool answered, uint32_t *next_probe);
@@ -0,0 +1,128 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include <lwip/sockets.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "liveness_probe.h"
+
+#define ICMP_ECHO_REPLY 0
+#define ICMP_ECHO_REQUEST 8
+// Tells our echoes apart from other pings' replies on a raw socket
+#define LIVENESS_PROBE_IDENTIFIER 0x5743
+
+
+static uint16_t icmp_checksum(const uint8_t *data, size_t length) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i + 1 < length; i += 2)
+                sum += (data[i] << 8) | data[i + 1];
+        if (length & 1)
+                sum += data[length - 1] << 8;
+        while (sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+        return ~sum;
+}
+
+
+int liveness_probe_open() {
+#ifdef ESP_PLATFORM
+        int fd = socket(AF_INET, SOCK_RAW, IPPROTO_ICMP);
+#else
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+#endif
+        if (fd < 0)
+                return -1;
+
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+
+void liveness_probe_close(int fd) {
+        if (fd >= 0)
+                close(fd);
+}
+
+
+int liveness_probe_send(int fd, uint32_t addr, uint16_t port, uint16_t id) {
+        uint8_t echo[16] = {
+                ICMP_ECHO_REQUEST, 0,
+                0, 0,                   // checksum
+                LIVENESS_PROBE_IDENTIFIER >> 8, LIVENESS_PROBE_IDENTIFIER & 0xff,
+                id >> 8, id & 0xff,
+                'w', 'i', 'f', 'i', 'c', 'f', 'g', 0,
+        };
+        uint16_t checksum = icmp_checksum(echo, sizeof(echo));
+        echo[2] = checksum >> 8;
+        echo[3] = checksum & 0xff;
+
+        struct sockaddr_in target;
+        memset(&target, 0, sizeof(target));
+        target.sin_family = AF_INET;
+#ifndef ESP_PLATFORM
+        target.sin_port = htons(port);
+#endif
+        target.sin_addr.s_addr = addr;
+
+        if (sendto(fd, echo, sizeof(echo), 0, (struct sockaddr *) &target, sizeof(target)) != sizeof(echo))
+                return -1;
+        return 0;
+}
+
+
+bool liveness_probe_answered(int fd, uint16_t id) {
+        bool answered = false;
+
+        uint8_t reply[96];
+        int length;
+        while ((length = recv(fd, reply, sizeof(reply), 0)) > 0) {
+                const uint8_t *echo = reply;
+#ifdef ESP_PLATFORM
+                // Raw sockets hand over the IP header as well
+                size_t header_length = (reply[0] & 0x0f) * 4;
+                if (length < (int) header_length)
+                        continue;
+                echo += header_length;
+                length -= header_length;
+#endif
+                if (length >= 8 && echo[0] == ICMP_ECHO_REPLY &&
+                    echo[4] == (LIVENESS_PROBE_IDENTIFIER >> 8) && echo[5] == (LIVENESS_PROBE_IDENTIFIER & 0xff) &&
+                    echo[6] == (id >> 8) && echo[7] == (id & 0xff))
+                        answered = true;
+        }
+
+        return answered;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Liveness probe: an ICMP echo to the gateway. The router answers it from
+// its own stack, so an uplink or DNS forwarder that died doesn't make a
+// healthy link look dead. On the device it goes out on a raw socket. On
+// the host the same message travels in a UDP datagram to a stand-in
+// gateway, which needs no privileges and can be made to stop answering.
+
+// Returns a non-blocking socket or -1
+int liveness_probe_open();
+void liveness_probe_close(int fd);
+
+// addr is an IPv4 address in network byte order. port is only used on the
+// host, where it is the stand-in gateway's UDP port.
+int liveness_probe_send(int fd, uint32_t addr, uint16_t port, uint16_t id);
+
+// Drains queued replies, true if one answered the probe with this id
+bool liveness_probe_answered(int fd, uint16_t id);
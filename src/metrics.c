@@ -0,0 +1,330 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
+
+#include "wifi_config.h"
+#include "metrics.h"
+
+
+// One slot per core, each on its own cache line
+typedef struct {
+        atomic_uint counters[METRIC_COUNTER_COUNT];
+        atomic_uint http_requests[METRICS_ENDPOINT_COUNT];
+        atomic_uint connect_failures[METRICS_CONNECT_FAILURE_COUNT];
+        atomic_uint histogram_buckets[METRIC_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS];
+        atomic_uint histogram_sum[METRIC_HISTOGRAM_COUNT];
+} __attribute__((aligned(32))) metrics_slot_t;
+
+static metrics_slot_t metrics_slots[portNUM_PROCESSORS];
+
+// A gauge, only ever written by the scan task
+static atomic_uint metrics_scan_ap_count;
+
+
+// Upper bounds in milliseconds, the implicit last bucket is +Inf
+static const uint32_t histogram_bounds[METRIC_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS - 1] = {
+        [METRIC_HISTOGRAM_HTTP_LATENCY] = { 5, 10, 25, 50, 100, 250, 1000 },
+        [METRIC_HISTOGRAM_SCAN_DURATION] = { 500, 1000, 1500, 2000, 3000, 5000, 10000 },
+        [METRIC_HISTOGRAM_TIME_TO_IP] = { 250, 500, 1000, 1500, 2000, 3000, 5000 },
+};
+
+static const char *histogram_names[METRIC_HISTOGRAM_COUNT] = {
+        [METRIC_HISTOGRAM_HTTP_LATENCY] = "wifi_config_http_request_duration_milliseconds",
+        [METRIC_HISTOGRAM_SCAN_DURATION] = "wifi_config_scan_duration_milliseconds",
+        [METRIC_HISTOGRAM_TIME_TO_IP] = "wifi_config_time_to_ip_milliseconds",
+};
+
+static const char *endpoint_labels[METRICS_ENDPOINT_COUNT] = {
+        [METRICS_ENDPOINT_OTHER] = "other",
+        [METRICS_ENDPOINT_INDEX] = "index",
+        [METRICS_ENDPOINT_SETTINGS] = "settings",
+        [METRICS_ENDPOINT_SETTINGS_UPDATE] = "settings_update",
+        [METRICS_ENDPOINT_ASSET] = "asset",
+        [METRICS_ENDPOINT_STATUS] = "status",
+        [METRICS_ENDPOINT_EVENTS] = "events",
+        [METRICS_ENDPOINT_METRICS] = "metrics",
+        [METRICS_ENDPOINT_PROVISION] = "provision",
+        [METRICS_ENDPOINT_OTA] = "ota",
+};
+
+static const char *connect_failure_labels[METRICS_CONNECT_FAILURE_COUNT] = {
+        [METRICS_CONNECT_FAILURE_OTHER] = "other",
+        [METRICS_CONNECT_FAILURE_AUTH] = "auth",
+        [METRICS_CONNECT_FAILURE_NO_AP] = "no_ap_found",
+        [METRICS_CONNECT_FAILURE_HANDSHAKE_TIMEOUT] = "handshake_timeout",
+        [METRICS_CONNECT_FAILURE_ASSOC] = "assoc",
+        [METRICS_CONNECT_FAILURE_BEACON_TIMEOUT] = "beacon_timeout",
+};
+
+
+static inline metrics_slot_t *metrics_slot() {
+        // A task may migrate right after reading the core id; the add is
+        // still atomic, it just lands in the other core's slot
+        return &metrics_slots[xPortGetCoreID()];
+}
+
+
+static inline void metrics_inc(atomic_uint *value, uint32_t n) {
+        atomic_fetch_add_explicit(value, n, memory_order_relaxed);
+}
+
+
+void metrics_add(metric_counter_t counter, uint32_t value) {
+        metrics_inc(&metrics_slot()->counters[counter], value);
+}
+
+
+static void metrics_observe(metric_histogram_t histogram, uint32_t value) {
+        int bucket = 0;
+        while (bucket < METRICS_HISTOGRAM_BUCKETS - 1 && value > histogram_bounds[histogram][bucket])
+                bucket++;
+
+        metrics_slot_t *slot = metrics_slot();
+        metrics_inc(&slot->histogram_buckets[histogram][bucket], 1);
+        metrics_inc(&slot->histogram_sum[histogram], value);
+}
+
+
+void metrics_http_request(metrics_endpoint_t endpoint, uint32_t latency_ms) {
+        metrics_inc(&metrics_slot()->http_requests[endpoint], 1);
+        metrics_observe(METRIC_HISTOGRAM_HTTP_LATENCY, latency_ms);
+}
+
+
+void metrics_connect_failed(uint8_t reason) {
+        metrics_connect_failure_t failure;
+        switch (reason) {
+        case WIFI_REASON_AUTH_FAIL:
+        case WIFI_REASON_AUTH_EXPIRE:
+                failure = METRICS_CONNECT_FAILURE_AUTH;
+                break;
+        case WIFI_REASON_NO_AP_FOUND:
+                failure = METRICS_CONNECT_FAILURE_NO_AP;
+                break;
+        case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+        case WIFI_REASON_HANDSHAKE_TIMEOUT:
+                failure = METRICS_CONNECT_FAILURE_HANDSHAKE_TIMEOUT;
+                break;
+        case WIFI_REASON_ASSOC_FAIL:
+        case WIFI_REASON_ASSOC_EXPIRE:
+                failure = METRICS_CONNECT_FAILURE_ASSOC;
+                break;
+        case WIFI_REASON_BEACON_TIMEOUT:
+                failure = METRICS_CONNECT_FAILURE_BEACON_TIMEOUT;
+                break;
+        default:
+                failure = METRICS_CONNECT_FAILURE_OTHER;
+        }
+
+        metrics_inc(&metrics_slot()->connect_failures[failure], 1);
+}
+
+
+void metrics_scan_done(uint32_t duration_ms, uint32_t ap_count) {
+        metrics_observe(METRIC_HISTOGRAM_SCAN_DURATION, duration_ms);
+        atomic_store_explicit(&metrics_scan_ap_count, ap_count, memory_order_relaxed);
+}
+
+
+void metrics_connected(uint32_t time_to_ip_ms) {
+        metrics_observe(METRIC_HISTOGRAM_TIME_TO_IP, time_to_ip_ms);
+}
+
+
+static void metrics_sum(uint32_t *total, atomic_uint *values, size_t count) {
+        for (size_t i = 0; i < count; i++)
+                total[i] += atomic_load_explicit(&values[i], memory_order_relaxed);
+}
+
+
+void metrics_snapshot(metrics_snapshot_t *snapshot) {
+        memset(snapshot, 0, sizeof(*snapshot));
+
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+                metrics_slot_t *slot = &metrics_slots[core];
+                metrics_sum(snapshot->counters, slot->counters, METRIC_COUNTER_COUNT);
+                metrics_sum(snapshot->http_requests, slot->http_requests, METRICS_ENDPOINT_COUNT);
+                metrics_sum(snapshot->connect_failures, slot->connect_failures, METRICS_CONNECT_FAILURE_COUNT);
+                for (int h = 0; h < METRIC_HISTOGRAM_COUNT; h++)
+                        metrics_sum(snapshot->histogram_buckets[h], slot->histogram_buckets[h], METRICS_HISTOGRAM_BUCKETS);
+                metrics_sum(snapshot->histogram_sum, slot->histogram_sum, METRIC_HISTOGRAM_COUNT);
+        }
+
+        snapshot->scan_ap_count = atomic_load_explicit(&metrics_scan_ap_count, memory_order_relaxed);
+        snapshot->min_free_heap = esp_get_minimum_free_heap_size();
+}
+
+
+static void metrics_printf(template_output_t *output, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+static void metrics_printf(template_output_t *output, const char *format, ...) {
+        char line[160];
+
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+
+        if (length > 0)
+                template_write(output, line, length < sizeof(line) ? length : sizeof(line) - 1);
+}
+
+
+static void metrics_render_header(template_output_t *output, const char *name,
+                                  const char *type, const char *help) {
+        metrics_printf(output, "# HELP %s %s\n", name, help);
+        metrics_printf(output, "# TYPE %s %s\n", name, type);
+}
+
+
+static void metrics_render_histogram(template_output_t *output, const metrics_snapshot_t *snapshot,
+                                     metric_histogram_t histogram, const char *help) {
+        const char *name = histogram_names[histogram];
+        metrics_render_header(output, name, "histogram", help);
+
+        uint32_t count = 0;
+        for (int bucket = 0; bucket < METRICS_HISTOGRAM_BUCKETS; bucket++) {
+                count += snapshot->histogram_buckets[histogram][bucket];
+                if (bucket < METRICS_HISTOGRAM_BUCKETS - 1) {
+                        metrics_printf(output, "%s_bucket{le=\"%u\"} %u\n",
+                                       name, (unsigned) histogram_bounds[histogram][bucket], (unsigned) count);
+                } else {
+                        metrics_printf(output, "%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned) count);
+                }
+        }
+        metrics_printf(output, "%s_sum %u\n", name, (unsigned) snapshot->histogram_sum[histogram]);
+        metrics_printf(output, "%s_count %u\n", name, (unsigned) count);
+}
+
+
+static void metrics_render_counter(template_output_t *output, const char *name,
+                                   const char *help, uint32_t value) {
+        metrics_render_header(output, name, "counter", help);
+        metrics_printf(output, "%s %u\n", name, (unsigned) value);
+}
+
+
+void metrics_render(template_output_t *output, const metrics_snapshot_t *snapshot) {
+        metrics_render_header(output, "wifi_config_http_requests_total", "counter",
+                              "HTTP requests served by the portal");
+        for (int i = 0; i < METRICS_ENDPOINT_COUNT; i++) {
+                metrics_printf(output, "wifi_config_http_requests_total{endpoint=\"%s\"} %u\n",
+                               endpoint_labels[i], (unsigned) snapshot->http_requests[i]);
+        }
+
+        metrics_render_histogram(output, snapshot, METRIC_HISTOGRAM_HTTP_LATENCY,
+                                 "Time from the start of a request until its response was sent");
+
+        metrics_render_counter(output, "wifi_config_http_sent_bytes_total",
+                               "Bytes written to portal HTTP clients",
+                               snapshot->counters[METRIC_HTTP_BYTES_SENT]);
+        metrics_render_counter(output, "wifi_config_http_timeouts_total",
+                               "Portal HTTP connections closed for missing a deadline",
+                               snapshot->counters[METRIC_HTTP_TIMEOUTS]);
+        metrics_render_counter(output, "wifi_config_dns_queries_answered_total",
+                               "Captive portal DNS queries answered",
+                               snapshot->counters[METRIC_DNS_QUERIES_ANSWERED]);
+
+        metrics_render_histogram(output, snapshot, METRIC_HISTOGRAM_SCAN_DURATION,
+                                 "Duration of portal WiFi scans");
+
+        metrics_render_header(output, "wifi_config_scan_ap_count", "gauge",
+                              "Access points seen by the last scan");
+        metrics_printf(output, "wifi_config_scan_ap_count %u\n", (unsigned) snapshot->scan_ap_count);
+
+        metrics_render_counter(output, "wifi_config_connect_attempts_total",
+                               "Station connect attempts",
+                               snapshot->counters[METRIC_CONNECT_ATTEMPTS]);
+
+        metrics_render_header(output, "wifi_config_connect_failures_total", "counter",
+                              "Failed station connect attempts by disconnect reason");
+        for (int i = 0; i < METRICS_CONNECT_FAILURE_COUNT; i++) {
+                metrics_printf(output, "wifi_config_connect_failures_total{reason=\"%s\"} %u\n",
+                               connect_failure_labels[i], (unsigned) snapshot->connect_failures[i]);
+        }
+
+        metrics_render_histogram(output, snapshot, METRIC_HISTOGRAM_TIME_TO_IP,
+                                 "Time from the start of a connect attempt until the station got an address");
+
+        metrics_render_counter(output, "wifi_config_reconnects_total",
+                               "Connections established after the first one",
+                               snapshot->counters[METRIC_RECONNECTS]);
+        metrics_render_counter(output, "wifi_config_liveness_failures_total",
+                               "Connections dropped because the gateway stopped answering probes",
+                               snapshot->counters[METRIC_LIVENESS_FAILURES]);
+
+        metrics_render_header(output, "wifi_config_min_free_heap_bytes", "gauge",
+                              "Lowest amount of free heap since boot");
+        metrics_printf(output, "wifi_config_min_free_heap_bytes %u\n", (unsigned) snapshot->min_free_heap);
+}
+
+
+typedef struct {
+        char *buffer;
+        size_t size;
+        size_t length;
+} metrics_buffer_t;
+
+
+static void metrics_buffer_flush(void *arg, const char *data, size_t length) {
+        metrics_buffer_t *out = arg;
+        if (out->length + 1 < out->size) {
+                size_t n = out->size - 1 - out->length;
+                if (n > length)
+                        n = length;
+                memcpy(out->buffer + out->length, data, n);
+        }
+        out->length += length;
+}
+
+
+size_t wifi_config_metrics_format(char *buffer, size_t size) {
+        metrics_snapshot_t snapshot;
+        metrics_snapshot(&snapshot);
+
+        metrics_buffer_t out = { .buffer = buffer, .size = size };
+        char chunk[128];
+        template_output_t output = {
+                .buffer = chunk,
+                .size = sizeof(chunk),
+                .flush = metrics_buffer_flush,
+                .arg = &out,
+        };
+        metrics_render(&output, &snapshot);
+        template_flush(&output);
+
+        if (size)
+                buffer[out.length < size ? out.length : size - 1] = 0;
+
+        return out.length;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include "template.h"
+
+// Counters are kept per core and only summed up when a snapshot is taken,
+// so recording a sample is a single uncontended relaxed atomic add.
+
+typedef enum {
+        METRIC_HTTP_BYTES_SENT = 0,
+        METRIC_DNS_QUERIES_ANSWERED,
+        METRIC_CONNECT_ATTEMPTS,
+        METRIC_RECONNECTS,
+        METRIC_HTTP_TIMEOUTS,
+        METRIC_LIVENESS_FAILURES,
+        METRIC_COUNTER_COUNT,
+} metric_counter_t;
+
+// Label values of wifi_config_http_requests_total
+typedef enum {
+        METRICS_ENDPOINT_OTHER = 0,
+        METRICS_ENDPOINT_INDEX,
+        METRICS_ENDPOINT_SETTINGS,
+        METRICS_ENDPOINT_SETTINGS_UPDATE,
+        METRICS_ENDPOINT_ASSET,
+        METRICS_ENDPOINT_STATUS,
+        METRICS_ENDPOINT_EVENTS,
+        METRICS_ENDPOINT_METRICS,
+        METRICS_ENDPOINT_PROVISION,
+        METRICS_ENDPOINT_OTA,
+        METRICS_ENDPOINT_COUNT,
+} metrics_endpoint_t;
+
+// Label values of wifi_config_connect_failures_total
+typedef enum {
+        METRICS_CONNECT_FAILURE_OTHER = 0,
+        METRICS_CONNECT_FAILURE_AUTH,
+        METRICS_CONNECT_FAILURE_NO_AP,
+        METRICS_CONNECT_FAILURE_HANDSHAKE_TIMEOUT,
+        METRICS_CONNECT_FAILURE_ASSOC,
+        METRICS_CONNECT_FAILURE_BEACON_TIMEOUT,
+        METRICS_CONNECT_FAILURE_COUNT,
+} metrics_connect_failure_t;
+
+typedef enum {
+        METRIC_HISTOGRAM_HTTP_LATENCY = 0,
+        METRIC_HISTOGRAM_SCAN_DURATION,
+        METRIC_HISTOGRAM_TIME_TO_IP,
+        METRIC_HISTOGRAM_COUNT,
+} metric_histogram_t;
+
+#define METRICS_HISTOGRAM_BUCKETS 8
+
+typedef struct {
+        uint32_t counters[METRIC_COUNTER_COUNT];
+        uint32_t http_requests[METRICS_ENDPOINT_COUNT];
+        uint32_t connect_failures[METRICS_CONNECT_FAILURE_COUNT];
+        // Per bucket (not cumulative) counts, the last bucket is +Inf
+        uint32_t histogram_buckets[METRIC_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS];
+        uint32_t histogram_sum[METRIC_HISTOGRAM_COUNT];
+
+        uint32_t scan_ap_count;
+        uint32_t min_free_heap;
+} metrics_snapshot_t;
+
+void metrics_add(metric_counter_t counter, uint32_t value);
+void metrics_http_request(metrics_endpoint_t endpoint, uint32_t latency_ms);
+// Takes a WIFI_REASON_* code of a failed connect attempt
+void metrics_connect_failed(uint8_t reason);
+void metrics_scan_done(uint32_t duration_ms, uint32_t ap_count);
+// Time from the start of a connect attempt until the station had an address
+void metrics_connected(uint32_t time_to_ip_ms);
+
+void metrics_snapshot(metrics_snapshot_t *snapshot);
+// Writes a snapshot in the Prometheus text exposition format (version 0.0.4)
+void metrics_render(template_output_t *output, const metrics_snapshot_t *snapshot);
@@ -0,0 +1,362 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <mbedtls/sha256.h>
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// The host build has no flash; a plain file stands in for the partition
+#ifndef WIFI_CONFIG_OTA_HOST_FILE
+#define WIFI_CONFIG_OTA_HOST_FILE "ota_partition.bin"
+#endif
+#else
+#include <esp_ota_ops.h>
+#endif
+
+#include "async_log.h"
+#include "ota_upload.h"
+
+#define INFO(message, ...) ASYNC_LOG(ASYNC_LOG_INFO, ">>> ota_upload: " message "\n", ## __VA_ARGS__)
+#define ERROR(message, ...) ASYNC_LOG(ASYNC_LOG_ERROR, "!!! ota_upload: " message "\n", ## __VA_ARGS__)
+
+#ifndef WIFI_CONFIG_OTA_BUFFER_SIZE
+#define WIFI_CONFIG_OTA_BUFFER_SIZE 4096
+#endif
+#ifndef WIFI_CONFIG_OTA_WRITER_STACK_SIZE
+#define WIFI_CONFIG_OTA_WRITER_STACK_SIZE 4096
+#endif
+#ifndef WIFI_CONFIG_OTA_WRITE_TIMEOUT
+#define WIFI_CONFIG_OTA_WRITE_TIMEOUT 10000
+#endif
+
+
+typedef struct {
+        uint8_t *buffers[2];
+        // Bytes in each buffer; a buffer is busy from the moment it is
+        // handed to the writer until the writer has flashed it
+        size_t fill[2];
+        volatile bool busy[2];
+        int current;
+
+        QueueHandle_t filled;
+        SemaphoreHandle_t drained;
+        SemaphoreHandle_t stopped;
+        TaskHandle_t writer;
+
+        mbedtls_sha256_context sha256;
+        volatile bool failed;
+        // The writer didn't hand its buffers back in time, so the upload
+        // can't be freed yet; the next ota_upload_begin() finishes the job
+        bool stalled;
+        size_t size;
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+        FILE *file;
+#else
+        const esp_partition_t *partition;
+        esp_ota_handle_t handle;
+#endif
+
+        int64_t started;
+        size_t heap_start;
+        size_t heap_low;
+} ota_upload_t;
+
+static ota_upload_t *upload = NULL;
+
+
+static int ota_partition_open(size_t expected_size) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+        upload->file = fopen(WIFI_CONFIG_OTA_HOST_FILE, "wb");
+        return upload->file ? 0 : -1;
+#else
+        upload->partition = esp_ota_get_next_update_partition(NULL);
+        if (!upload->partition) {
+                ERROR("No OTA partition to update");
+                return -1;
+        }
+        if (expected_size > upload->partition->size) {
+                ERROR("Image of %u bytes doesn't fit %s", (unsigned) expected_size, upload->partition->label);
+                return -1;
+        }
+        // Sectors are erased as esp_ota_write() reaches them, on the writer
+        // task; erasing the whole partition here would block the HTTP task
+        // for seconds
+        if (esp_ota_begin(upload->partition, OTA_WITH_SEQUENTIAL_WRITES, &upload->handle) != ESP_OK) {
+                ERROR("Failed to start OTA on %s", upload->partition->label);
+                return -1;
+        }
+        return 0;
+#endif
+}
+
+
+static int ota_partition_write(const uint8_t *data, size_t length) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+        return fwrite(data, 1, length, upload->file) == length ? 0 : -1;
+#else
+        return esp_ota_write(upload->handle, data, length) == ESP_OK ? 0 : -1;
+#endif
+}
+
+
+static int ota_partition_close(bool commit) {
+#ifdef CONFIG_IDF_TARGET_LINUX
+        int result = fclose(upload->file) ? -1 : 0;
+        upload->file = NULL;
+        return result;
+#else
+        if (!commit) {
+                esp_ota_abort(upload->handle);
+                return 0;
+        }
+        if (esp_ota_end(upload->handle) != ESP_OK) {
+                ERROR("Uploaded image is not valid");
+                return -1;
+        }
+        if (esp_ota_set_boot_partition(upload->partition) != ESP_OK) {
+                ERROR("Failed to select %s for boot", upload->partition->label);
+                return -1;
+        }
+        return 0;
+#endif
+}
+
+
+static void ota_writer_task(void *arg) {
+        int index;
+        while (xQueueReceive(upload->filled, &index, portMAX_DELAY) == pdTRUE && index >= 0) {
+                if (!upload->failed) {
+                        mbedtls_sha256_update(&upload->sha256, upload->buffers[index], upload->fill[index]);
+                        if (ota_partition_write(upload->buffers[index], upload->fill[index])) {
+                                ERROR("Flash write failed at offset %u", (unsigned) upload->size);
+                                upload->failed = true;
+                        }
+                }
+                upload->size += upload->fill[index];
+
+                upload->fill[index] = 0;
+                upload->busy[index] = false;
+                xSemaphoreGive(upload->drained);
+        }
+
+        xSemaphoreGive(upload->stopped);
+        vTaskSuspend(NULL);
+}
+
+
+static void ota_upload_free() {
+        if (upload->writer) {
+                int stop = -1;
+                xQueueSend(upload->filled, &stop, portMAX_DELAY);
+                xSemaphoreTake(upload->stopped, portMAX_DELAY);
+                vTaskDelete(upload->writer);
+        }
+        if (upload->filled)
+                vQueueDelete(upload->filled);
+        if (upload->drained)
+                vSemaphoreDelete(upload->drained);
+        if (upload->stopped)
+                vSemaphoreDelete(upload->stopped);
+        mbedtls_sha256_free(&upload->sha256);
+        free(upload->buffers[0]);
+        free(upload->buffers[1]);
+        free(upload);
+        upload = NULL;
+}
+
+
+// Waits until the writer handed back both buffers, for at most
+// WIFI_CONFIG_OTA_WRITE_TIMEOUT in total. Returns false if it didn't.
+static bool ota_upload_drain() {
+        int64_t deadline = esp_timer_get_time() + WIFI_CONFIG_OTA_WRITE_TIMEOUT * 1000LL;
+        while (upload->busy[0] || upload->busy[1]) {
+                int64_t remaining = deadline - esp_timer_get_time();
+                if (remaining <= 0)
+                        return false;
+                xSemaphoreTake(upload->drained, pdMS_TO_TICKS((uint32_t) (remaining / 1000)) + 1);
+        }
+        return true;
+}
+
+
+int ota_upload_begin(size_t expected_size) {
+        if (upload && upload->stalled && !upload->busy[0] && !upload->busy[1])
+                ota_upload_abort();
+        if (upload) {
+                ERROR("Upload already in progress");
+                return -1;
+        }
+
+        size_t heap_start = esp_get_free_heap_size();
+
+        upload = calloc(1, sizeof(ota_upload_t));
+        if (!upload)
+                return -1;
+
+        upload->started = esp_timer_get_time();
+        upload->heap_start = heap_start;
+        upload->heap_low = heap_start;
+        mbedtls_sha256_init(&upload->sha256);
+        mbedtls_sha256_starts(&upload->sha256, 0);
+
+        upload->buffers[0] = malloc(WIFI_CONFIG_OTA_BUFFER_SIZE);
+        upload->buffers[1] = malloc(WIFI_CONFIG_OTA_BUFFER_SIZE);
+        upload->filled = xQueueCreate(3, sizeof(int));
+        upload->drained = xSemaphoreCreateBinary();
+        upload->stopped = xSemaphoreCreateBinary();
+        if (!upload->buffers[0] || !upload->buffers[1] || !upload->filled ||
+            !upload->drained || !upload->stopped) {
+                ERROR("Failed to allocate upload buffers");
+                ota_upload_free();
+                return -1;
+        }
+
+        if (ota_partition_open(expected_size)) {
+                ota_upload_free();
+                return -1;
+        }
+
+        if (xTaskCreate(ota_writer_task, "wifi_config OTA", WIFI_CONFIG_OTA_WRITER_STACK_SIZE,
+                        NULL, 3, &upload->writer) != pdPASS) {
+                ERROR("Failed to create OTA writer task");
+                upload->writer = NULL;
+                ota_partition_close(false);
+                ota_upload_free();
+                return -1;
+        }
+
+        INFO("Receiving firmware (%u bytes)", (unsigned) expected_size);
+        return 0;
+}
+
+
+static void ota_upload_hand_off() {
+        int index = upload->current;
+        upload->busy[index] = true;
+        xQueueSend(upload->filled, &index, portMAX_DELAY);
+        upload->current ^= 1;
+
+        size_t heap = esp_get_free_heap_size();
+        if (heap < upload->heap_low)
+                upload->heap_low = heap;
+}
+
+
+size_t ota_upload_space() {
+        if (!upload || upload->busy[upload->current])
+                return 0;
+        return WIFI_CONFIG_OTA_BUFFER_SIZE - upload->fill[upload->current];
+}
+
+
+size_t ota_upload_write(const char *data, size_t length) {
+        size_t written = 0;
+        while (written < length) {
+                size_t space = ota_upload_space();
+                if (!space)
+                        break;
+
+                size_t n = length - written < space ? length - written : space;
+                int index = upload->current;
+                memcpy(upload->buffers[index] + upload->fill[index], data + written, n);
+                upload->fill[index] += n;
+                written += n;
+
+                if (upload->fill[index] == WIFI_CONFIG_OTA_BUFFER_SIZE)
+                        ota_upload_hand_off();
+        }
+        return written;
+}
+
+
+int ota_upload_finish(const uint8_t *expected_sha256, ota_upload_result_t *result) {
+        if (!upload)
+                return -1;
+
+        if (upload->fill[upload->current] && !upload->busy[upload->current])
+                ota_upload_hand_off();
+
+        if (!ota_upload_drain()) {
+                ERROR("Timed out waiting for flash writes");
+                upload->failed = true;
+                upload->stalled = true;
+                return -1;
+        }
+
+        memset(result, 0, sizeof(*result));
+        mbedtls_sha256_finish(&upload->sha256, result->sha256);
+        result->size = upload->size;
+        result->duration_ms = (esp_timer_get_time() - upload->started) / 1000;
+        result->peak_heap = upload->heap_start - upload->heap_low;
+
+        bool valid = !upload->failed &&
+                     (!expected_sha256 || !memcmp(expected_sha256, result->sha256, sizeof(result->sha256)));
+        if (!upload->failed && !valid)
+                ERROR("SHA-256 mismatch, discarding image");
+
+        int status = ota_partition_close(valid);
+        if (!valid)
+                status = -1;
+
+        if (!status) {
+                INFO("Received %u bytes in %u ms (%u kB/s), peak heap %u bytes",
+                     (unsigned) result->size, (unsigned) result->duration_ms,
+                     (unsigned) (result->duration_ms ? result->size / result->duration_ms : 0),
+                     (unsigned) result->peak_heap);
+        }
+
+        ota_upload_free();
+        return status;
+}
+
+
+int ota_upload_abort() {
+        if (!upload)
+                return 0;
+
+        if (!upload->stalled)
+                ERROR("Upload aborted after %u bytes", (unsigned) (upload->size + upload->fill[0] + upload->fill[1]));
+
+        // Let the writer finish what it has before the partition is closed
+        upload->failed = true;
+        if (!ota_upload_drain()) {
+                ERROR("Flash writer stalled, upload is released once it returns");
+                upload->stalled = true;
+                return -1;
+        }
+
+        ota_partition_close(false);
+        ota_upload_free();
+        return 0;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Streams a firmware image into the inactive OTA partition through two
+// fixed buffers. The HTTP task fills one while a writer task flashes and
+// hashes the other; when both are full, ota_upload_space() returns 0 and
+// the caller stops reading the socket, letting TCP throttle the sender.
+// One upload at a time.
+
+typedef struct {
+        size_t size;
+        uint8_t sha256[32];
+        uint32_t duration_ms;
+        // Heap taken by the upload at its peak: buffers, writer task and
+        // whatever the OTA driver allocated
+        size_t peak_heap;
+} ota_upload_result_t;
+
+// expected_size may be 0 if unknown. Returns 0 on success.
+int ota_upload_begin(size_t expected_size);
+
+// Bytes ota_upload_write() can take right now without blocking
+size_t ota_upload_space();
+
+// Takes at most ota_upload_space() bytes, returns the number taken
+size_t ota_upload_write(const char *data, size_t length);
+
+// Flushes the last buffer, waits for the writer and finalizes the image.
+// The new image is only made bootable if its digest matches
+// expected_sha256 (when not NULL). Returns 0 on success.
+int ota_upload_finish(const uint8_t *expected_sha256, ota_upload_result_t *result);
+
+// Discards the upload. Returns -1 if the writer is still stuck in a flash
+// write after WIFI_CONFIG_OTA_WRITE_TIMEOUT; the upload is then released
+// by a later ota_upload_begin() once the writer returned.
+int ota_upload_abort();
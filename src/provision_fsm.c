@@ -0,0 +1,149 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include "provision_fsm.h"
+
+// Deferral while a page is being served and while a scan holds the radio
+#define HTTP_BUSY_DELAY 200
+#define RADIO_BUSY_DELAY 500
+
+
+void provision_init(provision_state_t *state, const provision_config_t *config, uint32_t now) {
+        state->first_time = true;
+        state->link_up = false;
+        state->drops = 0;
+        state->since = now;
+        state->backoff = config->backoff_min;
+        state->monitor_interval = config->disconnected_interval;
+}
+
+
+uint32_t provision_monitor(provision_state_t *state, const provision_config_t *config,
+                           const provision_inputs_t *inputs) {
+        if (inputs->got_ip) {
+                bool resumed = !state->link_up;
+                if (resumed) {
+                        state->link_up = true;
+                        state->since = inputs->now;
+                        state->backoff = config->backoff_min;
+                } else if (state->drops && inputs->now - state->since >= config->stable_time) {
+                        state->drops = 0;
+                }
+
+                if (inputs->portal_up || state->first_time) {
+                        state->first_time = false;
+                        state->monitor_interval = config->connected_interval;
+
+                        return PROVISION_CONNECTED | PROVISION_SOFTAP_STOP | PROVISION_SET_INTERVAL;
+                }
+
+                // Connected and already reported
+                if (!resumed)
+                        return 0;
+
+                // The drop never got past the grace period, so the application
+                // never heard of it
+                state->monitor_interval = config->connected_interval;
+                return PROVISION_RESUMED | PROVISION_SET_INTERVAL;
+        }
+
+        if (state->link_up) {
+                state->link_up = false;
+                state->since = inputs->now;
+                if (state->drops < UINT8_MAX)
+                        state->drops++;
+        }
+
+        uint32_t actions = PROVISION_ROAMING_STOP;
+        if (inputs->has_config)
+                actions |= PROVISION_SCHEDULE_CONNECT;
+
+        // The portal is already up for the user
+        if (inputs->portal_up)
+                return actions;
+
+        state->monitor_interval = config->disconnected_interval;
+
+        // Give reconnect attempts a chance first, a router reboot shouldn't
+        // cycle the portal or reach the application
+        if (inputs->has_config && inputs->now - state->since < provision_grace(state, config))
+                return actions | PROVISION_SET_INTERVAL;
+
+        if (!state->first_time)
+                actions |= PROVISION_DISCONNECTED;
+
+        return actions | PROVISION_SET_INTERVAL | PROVISION_SOFTAP_START;
+}
+
+
+uint32_t provision_grace(const provision_state_t *state, const provision_config_t *config) {
+        uint32_t grace = config->grace;
+        for (int i = 1; i < state->drops && grace < config->grace_max; i++)
+                grace *= 2;
+
+        return grace > config->grace_max ? config->grace_max : grace;
+}
+
+
+provision_connect_t provision_connect_due(bool got_ip, uint32_t attempt_remaining, bool http_busy,
+                                          bool radio_busy, uint32_t *delay) {
+        if (got_ip)
+                return PROVISION_CONNECT_SKIP;
+
+        // A new esp_wifi_connect() would abort an association or DHCP
+        // exchange that is still running
+        if (attempt_remaining) {
+                *delay = attempt_remaining;
+                return PROVISION_CONNECT_DEFER;
+        }
+
+        // Don't pull the radio off the SoftAP channel while a page is loading
+        if (http_busy) {
+                *delay = HTTP_BUSY_DELAY;
+                return PROVISION_CONNECT_DEFER;
+        }
+
+        if (radio_busy) {
+                *delay = RADIO_BUSY_DELAY;
+                return PROVISION_CONNECT_DEFER;
+        }
+
+        return PROVISION_CONNECT_ATTEMPT;
+}
+
+
+uint32_t provision_connect_started(provision_state_t *state, const provision_config_t *config,
+                                   uint32_t random) {
+        // Equal jitter: wait between half and all of the current backoff
+        uint32_t backoff = state->backoff;
+        uint32_t delay = backoff / 2 + random % (backoff / 2 + 1);
+
+        state->backoff = backoff * 2 > config->backoff_max ? config->backoff_max : backoff * 2;
+
+        return delay;
+}
+
+
+void provision_backoff_reset(provision_state_t *state, const provision_config_t *config) {
+        state->backoff = config->backoff_min;
+}
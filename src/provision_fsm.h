@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Decisions of the connection monitor and the connect timer, kept free of
+// ESP-IDF calls so the firmware and the host simulator in
+// tools/provision_sim.c run the same logic. Times are in milliseconds.
+
+typedef struct {
+        uint32_t backoff_min;
+        uint32_t backoff_max;
+        uint32_t connected_interval;     // monitor period while connected
+        uint32_t disconnected_interval;  // monitor period otherwise
+        // Reconnect attempts run alone for the grace period after a drop
+        // (or from boot) before the portal starts and the drop is reported.
+        // Each drop doubles it up to grace_max until the link has held for
+        // stable_time.
+        uint32_t grace;
+        uint32_t grace_max;
+        uint32_t stable_time;
+} provision_config_t;
+
+typedef struct {
+        bool first_time;                 // nothing reported to the application yet
+        bool link_up;                    // IP seen by the last tick
+        uint8_t drops;                   // since the link was last stable
+        uint32_t since;                  // when link_up last changed
+        uint32_t backoff;
+        uint32_t monitor_interval;
+} provision_state_t;
+
+typedef struct {
+        bool got_ip;
+        bool portal_up;                  // SoftAP running, i.e. not in pure station mode
+        bool has_config;                 // only looked at without an IP
+        uint32_t now;
+} provision_inputs_t;
+
+// What a monitor tick asks the caller to do, as bits of the return value
+#define PROVISION_CONNECTED        (1 << 0)  // stop the connect timer, start roaming, report
+#define PROVISION_DISCONNECTED     (1 << 1)  // report a lost connection
+#define PROVISION_ROAMING_STOP     (1 << 2)
+#define PROVISION_SCHEDULE_CONNECT (1 << 3)  // arm the connect timer unless it is armed
+#define PROVISION_SOFTAP_START     (1 << 4)
+#define PROVISION_SOFTAP_STOP      (1 << 5)
+#define PROVISION_SET_INTERVAL     (1 << 6)  // monitor period is now state->monitor_interval
+#define PROVISION_RESUMED          (1 << 7)  // back within the grace period: stop the connect
+                                             // timer and start roaming, but don't report
+
+typedef enum {
+        PROVISION_CONNECT_SKIP = 0,      // already connected
+        PROVISION_CONNECT_DEFER,         // attempt in flight, radio or portal busy, retry after *delay
+        PROVISION_CONNECT_ATTEMPT,
+} provision_connect_t;
+
+void provision_init(provision_state_t *state, const provision_config_t *config, uint32_t now);
+
+uint32_t provision_monitor(provision_state_t *state, const provision_config_t *config,
+                           const provision_inputs_t *inputs);
+
+// attempt_remaining is how much longer the attempt in flight may keep the
+// radio (see WIFI_CONFIG_CONNECT_ATTEMPT_TIME), 0 if none is running
+provision_connect_t provision_connect_due(bool got_ip, uint32_t attempt_remaining, bool http_busy,
+                                          bool radio_busy, uint32_t *delay);
+
+// Call once an attempt started. Returns the delay until the next attempt,
+// between half and all of the current backoff, and doubles the backoff.
+uint32_t provision_connect_started(provision_state_t *state, const provision_config_t *config,
+                                   uint32_t random);
+
+// Current grace period, grown by recent drops
+uint32_t provision_grace(const provision_state_t *state, const provision_config_t *config);
+
+// New credentials or a connection: the next attempts start from the minimum
+void provision_backoff_reset(provision_state_t *state, const provision_config_t *config);
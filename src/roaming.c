@@ -0,0 +1,90 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <string.h>
+#include "roaming.h"
+
+// Exponential moving average with a weight of 1/8 per sample
+#define RSSI_SCALE 16
+#define RSSI_WEIGHT_SHIFT 3
+
+
+void roaming_reset(roaming_state_t *state) {
+        memset(state, 0, sizeof(*state));
+}
+
+
+void roaming_add_rssi_sample(roaming_state_t *state, int8_t rssi) {
+        int32_t sample = rssi * RSSI_SCALE;
+        if (!state->rssi_valid) {
+                state->rssi_average = sample;
+                state->rssi_valid = true;
+                return;
+        }
+
+        state->rssi_average += (sample - state->rssi_average) / (1 << RSSI_WEIGHT_SHIFT);
+}
+
+
+int8_t roaming_rssi(const roaming_state_t *state) {
+        return state->rssi_average / RSSI_SCALE;
+}
+
+
+bool roaming_should_scan(roaming_state_t *state, const roaming_config_t *config, uint32_t now) {
+        if (!state->rssi_valid || roaming_rssi(state) >= config->rssi_threshold)
+                return false;
+
+        if (now - state->window_start >= config->scan_window) {
+                state->window_start = now;
+                state->window_scans = 0;
+        }
+
+        if (state->window_scans >= config->scan_budget)
+                return false;
+
+        state->window_scans++;
+        return true;
+}
+
+
+int roaming_pick_candidate(const roaming_state_t *state, const roaming_config_t *config,
+                           const uint8_t *current_bssid,
+                           const roaming_candidate_t *candidates, size_t count) {
+        if (!state->rssi_valid)
+                return -1;
+
+        int best = -1;
+        int best_rssi = roaming_rssi(state) + config->hysteresis;
+        for (size_t i = 0; i < count; i++) {
+                if (!memcmp(candidates[i].bssid, current_bssid, 6))
+                        continue;
+
+                if (candidates[i].rssi > best_rssi) {
+                        best = i;
+                        best_rssi = candidates[i].rssi;
+                }
+        }
+
+        return best;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Roaming decisions, kept free of ESP-IDF calls so they can be exercised on
+// the host. Times are in milliseconds, RSSI in dBm.
+
+typedef struct {
+        int8_t rssi_threshold;   // look for a better BSS only below this average
+        uint8_t hysteresis;      // dB a candidate must beat the current average by
+        uint8_t scan_budget;     // background scans allowed per scan window
+        uint32_t scan_window;
+} roaming_config_t;
+
+typedef struct {
+        int32_t rssi_average;    // moving average in 1/16 dBm
+        bool rssi_valid;
+        uint32_t window_start;
+        uint8_t window_scans;
+} roaming_state_t;
+
+typedef struct {
+        uint8_t bssid[6];
+        int8_t rssi;
+} roaming_candidate_t;
+
+void roaming_reset(roaming_state_t *state);
+void roaming_add_rssi_sample(roaming_state_t *state, int8_t rssi);
+int8_t roaming_rssi(const roaming_state_t *state);
+
+// Returns true and consumes scan budget when a background scan is worth it
+bool roaming_should_scan(roaming_state_t *state, const roaming_config_t *config, uint32_t now);
+
+// Returns the index of the candidate to roam to, or -1 to stay
+int roaming_pick_candidate(const roaming_state_t *state, const roaming_config_t *config,
+                           const uint8_t *current_bssid,
+                           const roaming_candidate_t *candidates, size_t count);
@@ -0,0 +1,157 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <string.h>
+#include "template.h"
+
+
+void template_flush(template_output_t *output) {
+        if (output->length) {
+                output->flush(output->arg, output->buffer, output->length);
+                output->length = 0;
+        }
+}
+
+
+void template_write(template_output_t *output, const char *data, size_t length) {
+        if (!output->buffer) {
+                output->length += length;
+                return;
+        }
+
+        while (length) {
+                if (output->length == output->size)
+                        template_flush(output);
+
+                size_t n = output->size - output->length;
+                if (n > length)
+                        n = length;
+
+                memcpy(output->buffer + output->length, data, n);
+                output->length += n;
+                data += n;
+                length -= n;
+        }
+}
+
+
+void template_write_string(template_output_t *output, const char *s) {
+        template_write(output, s, strlen(s));
+}
+
+
+static const char *html_entity(char c) {
+        switch (c) {
+        case '&': return "&amp;";
+        case '<': return "&lt;";
+        case '>': return "&gt;";
+        case '"': return "&quot;";
+        case '\'': return "&#39;";
+        default: return NULL;
+        }
+}
+
+
+void template_write_html_escaped(template_output_t *output, const char *s) {
+        const char *run = s;
+        for (; *s; s++) {
+                const char *entity = html_entity(*s);
+                if (!entity)
+                        continue;
+
+                template_write(output, run, s - run);
+                template_write_string(output, entity);
+                run = s + 1;
+        }
+        template_write(output, run, s - run);
+}
+
+
+static size_t template_render_block(template_output_t *output, const template_op_t *ops, size_t i,
+                                    const template_data_t *data, const void *item) {
+        while (true) {
+                const template_op_t *op = &ops[i];
+                switch (op->type) {
+                case TEMPLATE_OP_TEXT:
+                        template_write(output, op->text, op->length);
+                        i++;
+                        break;
+
+                case TEMPLATE_OP_VALUE:
+                case TEMPLATE_OP_VALUE_RAW: {
+                        const char *value = data->value(op->arg, item, data->arg);
+                        if (value) {
+                                if (op->type == TEMPLATE_OP_VALUE)
+                                        template_write_html_escaped(output, value);
+                                else
+                                        template_write_string(output, value);
+                        }
+                        i++;
+                        break;
+                }
+
+                case TEMPLATE_OP_IF: {
+                        size_t end;
+                        if (data->test(op->arg, item, data->arg)) {
+                                end = template_render_block(output, ops, i + 1, data, item);
+                                if (ops[end].type == TEMPLATE_OP_ELSE)
+                                        end = ops[end].jump;
+                        } else {
+                                end = op->jump;
+                                if (ops[end].type == TEMPLATE_OP_ELSE)
+                                        end = template_render_block(output, ops, end + 1, data, item);
+                        }
+                        i = end + 1;
+                        break;
+                }
+
+                case TEMPLATE_OP_FOR: {
+                        const void *element = data->next(op->arg, NULL, data->arg);
+                        while (element) {
+                                template_render_block(output, ops, i + 1, data, element);
+                                element = data->next(op->arg, element, data->arg);
+                        }
+                        i = op->jump + 1;
+                        break;
+                }
+
+                default:
+                        // TEMPLATE_OP_ELSE, TEMPLATE_OP_END_IF, TEMPLATE_OP_END_FOR and
+                        // TEMPLATE_OP_END close the current block
+                        return i;
+                }
+        }
+}
+
+
+void template_render(template_output_t *output, const template_op_t *ops,
+                     const template_data_t *data) {
+        template_render_block(output, ops, 0, data, NULL);
+}
+
+
+size_t template_measure(const template_op_t *ops, const template_data_t *data) {
+        template_output_t output = { 0 };
+        template_render_block(&output, ops, 0, data, NULL);
+        return output.length;
+}
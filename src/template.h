@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Output sink for the template renderer. Data is collected in buffer and
+// handed to flush whenever it fills up, so rendering never allocates and
+// has no limit on the length of a value. An output without a buffer only
+// counts the bytes written into length.
+typedef struct {
+        char *buffer;
+        size_t size;
+        size_t length;
+
+        void (*flush)(void *arg, const char *data, size_t length);
+        void *arg;
+} template_output_t;
+
+void template_write(template_output_t *output, const char *data, size_t length);
+void template_write_string(template_output_t *output, const char *s);
+void template_write_html_escaped(template_output_t *output, const char *s);
+void template_flush(template_output_t *output);
+
+// Opcodes emitted by tools/generate_index_html_header.py. IF jumps to its
+// ELSE or END_IF, ELSE jumps to its END_IF, FOR jumps to its END_FOR and
+// END_FOR jumps back to its FOR. A table is terminated by TEMPLATE_OP_END.
+typedef enum {
+        TEMPLATE_OP_END = 0,
+        TEMPLATE_OP_TEXT,
+        TEMPLATE_OP_VALUE,
+        TEMPLATE_OP_VALUE_RAW,
+        TEMPLATE_OP_IF,
+        TEMPLATE_OP_ELSE,
+        TEMPLATE_OP_END_IF,
+        TEMPLATE_OP_FOR,
+        TEMPLATE_OP_END_FOR,
+} template_op_type_t;
+
+typedef struct {
+        uint8_t type;
+        uint8_t arg;
+        uint16_t jump;
+        uint16_t length;
+        const char *text;
+} template_op_t;
+
+// Binds template slots (TEMPLATE_VALUE_*) and lists (TEMPLATE_LIST_*) to data.
+// item is the current element of the innermost FOR loop, or NULL.
+typedef struct {
+        const char *(*value)(uint8_t slot, const void *item, void *arg);
+        bool (*test)(uint8_t slot, const void *item, void *arg);
+        // Returns the element following item in list (the first one if item
+        // is NULL), or NULL at the end of the list
+        const void *(*next)(uint8_t list, const void *item, void *arg);
+        void *arg;
+} template_data_t;
+
+void template_render(template_output_t *output, const template_op_t *ops,
+                     const template_data_t *data);
+
+// Returns the exact number of bytes template_render() would produce
+size_t template_measure(const template_op_t *ops, const template_data_t *data);
@@ -0,0 +1,111 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include "timer_wheel.h"
+
+#define TICKS_BEFORE(a, b) ((int32_t) ((a) - (b)) < 0)
+
+
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now) {
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+                wheel->slots[i].next = &wheel->slots[i];
+                wheel->slots[i].prev = &wheel->slots[i];
+        }
+        wheel->current = now;
+        wheel->count = 0;
+}
+
+
+void timer_wheel_entry_init(timer_wheel_entry_t *entry) {
+        entry->next = NULL;
+        entry->prev = NULL;
+}
+
+
+bool timer_wheel_pending(const timer_wheel_entry_t *entry) {
+        return entry->next != NULL;
+}
+
+
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_wheel_entry_t *entry) {
+        if (!timer_wheel_pending(entry))
+                return;
+
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+        timer_wheel_entry_init(entry);
+        wheel->count--;
+}
+
+
+void timer_wheel_schedule(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint32_t expires) {
+        timer_wheel_cancel(wheel, entry);
+
+        // Overdue entries go to the slot expired next
+        uint32_t slot_tick = TICKS_BEFORE(expires, wheel->current) ? wheel->current : expires;
+        timer_wheel_entry_t *head = &wheel->slots[slot_tick % TIMER_WHEEL_SLOTS];
+
+        entry->expires = expires;
+        entry->next = head;
+        entry->prev = head->prev;
+        head->prev->next = entry;
+        head->prev = entry;
+        wheel->count++;
+}
+
+
+timer_wheel_entry_t *timer_wheel_expire(timer_wheel_t *wheel, uint32_t now) {
+        while (true) {
+                if (!wheel->count) {
+                        if (TICKS_BEFORE(wheel->current, now))
+                                wheel->current = now;
+                        return NULL;
+                }
+
+                timer_wheel_entry_t *head = &wheel->slots[wheel->current % TIMER_WHEEL_SLOTS];
+                for (timer_wheel_entry_t *entry = head->next; entry != head; entry = entry->next) {
+                        if (!TICKS_BEFORE(wheel->current, entry->expires)) {
+                                timer_wheel_cancel(wheel, entry);
+                                return entry;
+                        }
+                }
+
+                if (!TICKS_BEFORE(wheel->current, now))
+                        return NULL;
+                wheel->current++;
+        }
+}
+
+
+uint32_t timer_wheel_next(const timer_wheel_t *wheel, uint32_t limit) {
+        if (!wheel->count)
+                return limit;
+
+        // The current slot only holds entries of later laps once expired
+        for (uint32_t ticks = 1; ticks < limit && ticks < TIMER_WHEEL_SLOTS; ticks++) {
+                const timer_wheel_entry_t *head = &wheel->slots[(wheel->current + ticks) % TIMER_WHEEL_SLOTS];
+                if (head->next != head)
+                        return ticks;
+        }
+        return limit;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hashed timer wheel for per-connection deadlines. Entries are embedded in
+// the objects they time out, so scheduling, cancelling and expiring are O(1)
+// without allocation. Times are in ticks of the caller's choosing and may
+// wrap; deadlines further out than the wheel's span stay in their slot for
+// more than one lap.
+
+#ifndef TIMER_WHEEL_SLOTS
+#define TIMER_WHEEL_SLOTS 32
+#endif
+
+typedef struct _timer_wheel_entry {
+        struct _timer_wheel_entry *next;
+        struct _timer_wheel_entry *prev;
+        uint32_t expires;
+} timer_wheel_entry_t;
+
+typedef struct {
+        // Slot heads are sentinels of circular lists
+        timer_wheel_entry_t slots[TIMER_WHEEL_SLOTS];
+        // Tick whose slot is expired next
+        uint32_t current;
+        size_t count;
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *wheel, uint32_t now);
+
+// Entries must be zeroed or cancelled before their first schedule
+void timer_wheel_entry_init(timer_wheel_entry_t *entry);
+bool timer_wheel_pending(const timer_wheel_entry_t *entry);
+
+// (Re)schedules the entry; a deadline in the past expires on the next call
+// to timer_wheel_expire()
+void timer_wheel_schedule(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint32_t expires);
+void timer_wheel_cancel(timer_wheel_t *wheel, timer_wheel_entry_t *entry);
+
+// Removes and returns one entry due at or before now, NULL once none is left
+timer_wheel_entry_t *timer_wheel_expire(timer_wheel_t *wheel, uint32_t now);
+
+// Ticks until the next slot holding an entry, at most limit. An entry there
+// may belong to a later lap, so this is a lower bound: waking early just
+// expires nothing.
+uint32_t timer_wheel_next(const timer_wheel_t *wheel, uint32_t limit);
@@ -0,0 +1,163 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+
+#include "wifi_config.h"
+#include "trace.h"
+
+#ifdef WIFI_CONFIG_TRACE
+
+#ifndef WIFI_CONFIG_TRACE_RECORDS
+#define WIFI_CONFIG_TRACE_RECORDS 512
+#endif
+
+_Static_assert((WIFI_CONFIG_TRACE_RECORDS & (WIFI_CONFIG_TRACE_RECORDS - 1)) == 0,
+               "WIFI_CONFIG_TRACE_RECORDS must be a power of two");
+
+#define TRACE_MAGIC "WCTR"
+#define TRACE_VERSION 1
+
+typedef struct {
+        int64_t timestamp;
+        uint16_t event;
+        uint8_t phase;
+        uint8_t core;
+        uint32_t arg;
+} trace_record_t;
+
+static trace_record_t trace_ring[WIFI_CONFIG_TRACE_RECORDS];
+// Total number of records claimed, the ring holds the last ones
+static atomic_uint trace_head;
+static atomic_bool trace_paused;
+
+static const char *trace_event_names[TRACE_EVENT_COUNT] = {
+        [TRACE_HTTP_ACCEPT] = "http_accept",
+        [TRACE_HTTP_READ] = "http_read",
+        [TRACE_HTTP_PARSE] = "http_parse",
+        [TRACE_HTTP_HANDLER] = "http_handler",
+        [TRACE_HTTP_SEND] = "http_send",
+        [TRACE_DNS_RECEIVE] = "dns_receive",
+        [TRACE_DNS_REPLY] = "dns_reply",
+        [TRACE_SCAN] = "scan",
+        [TRACE_WIFI_EVENT] = "wifi_event",
+};
+
+
+void trace_record(trace_event_t event, trace_phase_t phase, uint32_t arg) {
+        if (atomic_load_explicit(&trace_paused, memory_order_relaxed))
+                return;
+
+        // Claiming a slot is the only shared write, so any task or core can record
+        unsigned index = atomic_fetch_add_explicit(&trace_head, 1, memory_order_relaxed);
+        trace_record_t *record = &trace_ring[index & (WIFI_CONFIG_TRACE_RECORDS - 1)];
+
+        record->timestamp = esp_timer_get_time();
+        record->event = event;
+        record->phase = phase;
+        record->core = xPortGetCoreID();
+        record->arg = arg;
+}
+
+
+static void trace_dump_header(template_output_t *output, uint32_t count) {
+        uint8_t header[12];
+        memcpy(header, TRACE_MAGIC, 4);
+        uint16_t version = TRACE_VERSION;
+        uint16_t name_count = TRACE_EVENT_COUNT;
+        memcpy(header + 4, &version, 2);
+        memcpy(header + 6, &name_count, 2);
+        memcpy(header + 8, &count, 4);
+        template_write(output, (const char *) header, sizeof(header));
+
+        for (int i = 0; i < TRACE_EVENT_COUNT; i++)
+                template_write(output, trace_event_names[i], strlen(trace_event_names[i]) + 1);
+}
+
+
+static void trace_dump_records(template_output_t *output, unsigned head) {
+        unsigned count = head < WIFI_CONFIG_TRACE_RECORDS ? head : WIFI_CONFIG_TRACE_RECORDS;
+
+        trace_dump_header(output, count);
+        for (unsigned i = head - count; i != head; i++) {
+                template_write(output, (const char *) &trace_ring[i & (WIFI_CONFIG_TRACE_RECORDS - 1)],
+                               sizeof(trace_record_t));
+        }
+}
+
+
+size_t trace_dump_measure(uint32_t *head) {
+        // A task that saw trace_paused still clear can claim a slot after
+        // this, so the dump is bounded by the head read here, not by the pause
+        atomic_store(&trace_paused, true);
+        *head = atomic_load(&trace_head);
+
+        template_output_t counter = {0};
+        trace_dump_records(&counter, *head);
+        return counter.length;
+}
+
+
+void trace_dump(template_output_t *output, uint32_t head) {
+        trace_dump_records(output, head);
+        template_flush(output);
+        atomic_store(&trace_paused, false);
+}
+
+
+static void trace_console_flush(void *arg, const char *data, size_t length) {
+        for (size_t i = 0; i < length; i++)
+                printf("%02x", (uint8_t) data[i]);
+        printf("\n");
+}
+
+
+void wifi_config_trace_dump() {
+        char buffer[32];
+        uint32_t head;
+        trace_dump_measure(&head);
+
+        template_output_t output = {
+                .buffer = buffer,
+                .size = sizeof(buffer),
+                .flush = trace_console_flush,
+        };
+
+        printf("WCTRACE BEGIN\n");
+        trace_dump(&output, head);
+        printf("WCTRACE END\n");
+}
+
+#else
+
+void wifi_config_trace_dump() {
+        printf("wifi_config: built without WIFI_CONFIG_TRACE\n");
+}
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+
+// Binary trace ring for latency debugging. Built with WIFI_CONFIG_TRACE it
+// records a timestamped 16 byte entry per event; without it every TRACE_*
+// macro compiles to nothing. tools/trace_to_chrome.py turns a dump into a
+// Chrome/Perfetto trace.
+
+typedef enum {
+        TRACE_HTTP_ACCEPT = 0,
+        TRACE_HTTP_READ,
+        TRACE_HTTP_PARSE,
+        TRACE_HTTP_HANDLER,
+        TRACE_HTTP_SEND,
+        TRACE_DNS_RECEIVE,
+        TRACE_DNS_REPLY,
+        TRACE_SCAN,
+        TRACE_WIFI_EVENT,
+        TRACE_EVENT_COUNT,
+} trace_event_t;
+
+// Chrome trace event phases
+typedef enum {
+        TRACE_PHASE_BEGIN = 'B',
+        TRACE_PHASE_END = 'E',
+        TRACE_PHASE_INSTANT = 'i',
+} trace_phase_t;
+
+#ifdef WIFI_CONFIG_TRACE
+
+#include "template.h"
+
+void trace_record(trace_event_t event, trace_phase_t phase, uint32_t arg);
+
+// Dump format: "WCTR", u16 version, u16 name count, u32 record count, the
+// event names as NUL terminated strings, then the records oldest first.
+// Records are written in native byte order:
+// i64 timestamp (us), u16 event, u8 phase, u8 core, u32 arg.
+// trace_dump_measure() pauses recording, snapshots the head of the ring
+// into *head and returns the size of its dump. trace_dump() writes exactly
+// the records up to that head, even if some got in after the pause, and
+// resumes recording.
+size_t trace_dump_measure(uint32_t *head);
+void trace_dump(template_output_t *output, uint32_t head);
+
+#define TRACE_BEGIN(event, arg) trace_record((event), TRACE_PHASE_BEGIN, (arg))
+#define TRACE_END(event, arg) trace_record((event), TRACE_PHASE_END, (arg))
+#define TRACE_INSTANT(event, arg) trace_record((event), TRACE_PHASE_INSTANT, (arg))
+
+#else
+
+#define TRACE_BEGIN(event, arg) do {} while (0)
+#define TRACE_END(event, arg) do {} while (0)
+#define TRACE_INSTANT(event, arg) do {} while (0)
+
+#endif
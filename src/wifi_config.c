@@ -24,6 +24,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <ctype.h>
+#include <limits.h>
 #include <lwip/sockets.h>
 #include <lwip/ip_addr.h>
 
@@ -31,13 +33,17 @@
 #include <freertos/task.h>
 #include <freertos/timers.h>
 #include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
 
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <esp_netif.h>
 #include <esp_system.h>
 #include <esp_timer.h>
-#include <esp_log.h>
+#include <esp_random.h>
+#include <esp_attr.h>
+#include <esp_rom_crc.h>
 #include <nvs_flash.h>
 #include <nvs.h>
 
@@ -45,6 +51,23 @@
 
 #include "wifi_config.h"
 #include "form_urlencoded.h"
+#include "template.h"
+#include "asset_store.h"
+#include "roaming.h"
+#include "metrics.h"
+#include "trace.h"
+#include "async_log.h"
+#include "ota_upload.h"
+#include "ap_channel.h"
+#include "timer_wheel.h"
+#include "provision_fsm.h"
+#include "liveness.h"
+#include "liveness_probe.h"
+
+// Messages are formatted and printed later by the log task
+#define INFO(message, ...) ASYNC_LOG(ASYNC_LOG_INFO, ">>> wifi_config: " message "\n", ## __VA_ARGS__)
+#define ERROR(message, ...) ASYNC_LOG(ASYNC_LOG_ERROR, "!!! wifi_config: " message "\n", ## __VA_ARGS__)
+#define DEBUG(message, ...) ASYNC_LOG(ASYNC_LOG_DEBUG, "*** wifi_config: " message "\n", ## __VA_ARGS__)
 
 enum {
         STATION_MODE = 1,
@@ -58,6 +81,15 @@ enum {
 
 static nvs_handle_t wifi_cfg_handle;
 static volatile bool sta_got_ip = false;
+// Set while a connect attempt owns the radio, until it succeeds or fails
+static volatile bool sta_connecting = false;
+static volatile int64_t sta_connect_started = 0;
+static volatile int64_t sta_associated_at = 0;
+// Payloads for WIFI_CONFIG_CONNECTED/DISCONNECTED, kept by the event handler
+static esp_netif_ip_info_t sta_ip_info;
+static volatile uint8_t sta_disconnect_reason = 0;
+static esp_netif_t *ap_netif = NULL;
+static esp_netif_t *sta_netif = NULL;
 
 static wifi_mode_t opmode_to_wifi_mode(int mode) {
         switch (mode) {
@@ -84,7 +116,7 @@ static int sdk_wifi_get_opmode(void) {
 }
 
 static void sdk_wifi_set_opmode(int mode) {
-        ESP_LOGI("wifi_config", "Setting WiFi mode: %d", mode);
+        INFO("Setting WiFi mode: %d", mode);
         esp_wifi_set_mode(opmode_to_wifi_mode(mode));
 }
 
@@ -139,13 +171,94 @@ static void sysparam_get_string(const char *key, char **value) {
         }
 }
 
+// Progress events pushed to the portal's /events streams
+typedef enum {
+        PORTAL_EVENT_ASSOCIATING = 1,
+        PORTAL_EVENT_CONNECTED,
+        PORTAL_EVENT_DISCONNECTED,
+        PORTAL_EVENT_FAILED,
+        PORTAL_EVENT_SCAN_UPDATED,
+} portal_event_type_t;
+
+typedef struct {
+        uint8_t type;
+        uint32_t value;
+} portal_event_t;
+
+static void wifi_config_portal_event(portal_event_type_t type, uint32_t value);
+static void wifi_config_trial_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void wifi_config_roaming_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void portal_on_station_change(void *arg, uint32_t joined);
+static void wifi_config_prescan_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void wifi_config_roaming_start();
+static void wifi_config_roaming_stop();
+static void wifi_config_liveness_start();
+static void wifi_config_liveness_stop();
+static void wifi_config_event_emit(const wifi_config_event_info_t *info);
+
 static void wifi_event_handler(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data) {
+        static bool sta_connected_before = false;
+
+        // IP events are told apart from WiFi events by bit 16
+        TRACE_INSTANT(TRACE_WIFI_EVENT, (event_base == IP_EVENT ? 0x10000 : 0) | (uint16_t) event_id);
+
         if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+                if (sta_connecting) {
+                        int64_t now = esp_timer_get_time();
+                        uint32_t time_to_ip = (now - sta_connect_started) / 1000;
+                        uint32_t address_time = sta_associated_at > sta_connect_started ?
+                                                (now - sta_associated_at) / 1000 : 0;
+                        INFO("Got IP %u ms after the connect attempt started, %u ms after association",
+                             (unsigned) time_to_ip, (unsigned) address_time);
+                        metrics_connected(time_to_ip);
+                }
+
                 sta_got_ip = true;
+                sta_connecting = false;
+
+                if (sta_connected_before)
+                        metrics_add(METRIC_RECONNECTS, 1);
+                sta_connected_before = true;
+
+                ip_event_got_ip_t *event = event_data;
+                sta_ip_info = event->ip_info;
+                wifi_config_portal_event(PORTAL_EVENT_CONNECTED, event->ip_info.ip.addr);
+        } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+                sta_associated_at = esp_timer_get_time();
         } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+                wifi_event_sta_disconnected_t *event = event_data;
+                if (sta_connecting)
+                        metrics_connect_failed(event->reason);
+
                 sta_got_ip = false;
+                sta_connecting = false;
+                sta_disconnect_reason = event->reason;
+
+                wifi_config_portal_event(PORTAL_EVENT_DISCONNECTED, event->reason);
+        } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_START) {
+#if LWIP_IPV6
+                // Gives the portal a v6 address for AAAA answers and the v6 listeners
+                if (ap_netif)
+                        esp_netif_create_ip6_linklocal(ap_netif);
+#endif
+        } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED) {
+                wifi_event_ap_staconnected_t *event = event_data;
+                wifi_config_event_info_t info = { .event = WIFI_CONFIG_AP_CLIENT_JOINED };
+                memcpy(info.ap_client.mac, event->mac, sizeof(info.ap_client.mac));
+                wifi_config_event_emit(&info);
+                xTimerPendFunctionCall(portal_on_station_change, NULL, 1, 0);
+        } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STADISCONNECTED) {
+                wifi_event_ap_stadisconnected_t *event = event_data;
+                wifi_config_event_info_t info = { .event = WIFI_CONFIG_AP_CLIENT_LEFT };
+                memcpy(info.ap_client.mac, event->mac, sizeof(info.ap_client.mac));
+                wifi_config_event_emit(&info);
+                xTimerPendFunctionCall(portal_on_station_change, NULL, 0, 0);
         }
+
+        wifi_config_prescan_on_event(event_base, event_id, event_data);
+        wifi_config_trial_on_event(event_base, event_id, event_data);
+        wifi_config_roaming_on_event(event_base, event_id, event_data);
 }
 
 static int sdk_wifi_station_get_connect_status(void) {
@@ -158,14 +271,14 @@ static void wifi_config_init_wifi(void) {
 
         esp_netif_init();
         esp_event_loop_create_default();
-        esp_netif_create_default_wifi_ap();
-        esp_netif_create_default_wifi_sta();
+        ap_netif = esp_netif_create_default_wifi_ap();
+        sta_netif = esp_netif_create_default_wifi_sta();
 
         wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
         esp_wifi_init(&cfg);
         esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL);
         esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL);
-        ESP_LOGI("wifi_config", "Starting WiFi...");
+        INFO("Starting WiFi...");
         esp_wifi_start();
 
         wifi_inited = true;
@@ -173,6 +286,25 @@ static void wifi_config_init_wifi(void) {
 
 #define WIFI_CONFIG_SERVER_PORT 80
 
+
+// The SoftAP's address as configured on its netif (192.168.4.1 by default)
+static esp_ip4_addr_t wifi_config_portal_ip4() {
+        esp_netif_ip_info_t ip_info;
+        if (ap_netif && esp_netif_get_ip_info(ap_netif, &ip_info) == ESP_OK && ip_info.ip.addr)
+                return ip_info.ip;
+
+        esp_ip4_addr_t fallback;
+        esp_netif_str_to_ip4("192.168.4.1", &fallback);
+        return fallback;
+}
+
+
+#if LWIP_IPV6
+static bool wifi_config_portal_ip6(esp_ip6_addr_t *address) {
+        return ap_netif && esp_netif_get_ip6_linklocal(ap_netif, address) == ESP_OK;
+}
+#endif
+
 #ifndef WIFI_CONFIG_CONNECT_TIMEOUT
 #define WIFI_CONFIG_CONNECT_TIMEOUT 15000
 #endif
@@ -182,14 +314,142 @@ static void wifi_config_init_wifi(void) {
 #ifndef WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL
 #define WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL 10000
 #endif
-
-#define INFO(message, ...) printf(">>> wifi_config: " message "\n", ## __VA_ARGS__);
-#define ERROR(message, ...) printf("!!! wifi_config: " message "\n", ## __VA_ARGS__);
-
-#ifdef WIFI_CONFIG_DEBUG
-#define DEBUG(message, ...) printf("*** wifi_config: " message "\n", ## __VA_ARGS__);
-#else
-#define DEBUG(message, ...)
+#ifndef WIFI_CONFIG_CONNECT_BACKOFF_MIN
+#define WIFI_CONFIG_CONNECT_BACKOFF_MIN 2000
+#endif
+#ifndef WIFI_CONFIG_CONNECT_BACKOFF_MAX
+#define WIFI_CONFIG_CONNECT_BACKOFF_MAX 120000
+#endif
+// Reconnect attempts run alone this long after a drop before the portal
+// starts and WIFI_CONFIG_DISCONNECTED is reported. Repeated drops double it
+// up to GRACE_MAX until the link has held for STABLE_TIME.
+#ifndef WIFI_CONFIG_PORTAL_GRACE
+#define WIFI_CONFIG_PORTAL_GRACE 30000
+#endif
+#ifndef WIFI_CONFIG_PORTAL_GRACE_MAX
+#define WIFI_CONFIG_PORTAL_GRACE_MAX 240000
+#endif
+#ifndef WIFI_CONFIG_STABLE_TIME
+#define WIFI_CONFIG_STABLE_TIME 600000
+#endif
+// How long a connect attempt keeps the radio before scans may run again
+#ifndef WIFI_CONFIG_CONNECT_ATTEMPT_TIME
+#define WIFI_CONFIG_CONNECT_ATTEMPT_TIME 5000
+#endif
+#ifndef WIFI_CONFIG_ROAM_SAMPLE_INTERVAL
+#define WIFI_CONFIG_ROAM_SAMPLE_INTERVAL 5000
+#endif
+#ifndef WIFI_CONFIG_ROAM_RSSI_THRESHOLD
+#define WIFI_CONFIG_ROAM_RSSI_THRESHOLD -70
+#endif
+#ifndef WIFI_CONFIG_ROAM_HYSTERESIS
+#define WIFI_CONFIG_ROAM_HYSTERESIS 8
+#endif
+#ifndef WIFI_CONFIG_ROAM_SCAN_BUDGET
+#define WIFI_CONFIG_ROAM_SCAN_BUDGET 2
+#endif
+#ifndef WIFI_CONFIG_ROAM_SCAN_WINDOW
+#define WIFI_CONFIG_ROAM_SCAN_WINDOW 600000
+#endif
+// Gateway liveness probing, only with WIFI_CONFIG_LIVENESS. A link that
+// dies without a disconnect event is noticed within DETECT_TIME while a
+// healthy one gets PROBES_PER_MINUTE probes.
+#ifndef WIFI_CONFIG_LIVENESS_DETECT_TIME
+#define WIFI_CONFIG_LIVENESS_DETECT_TIME 20000
+#endif
+#ifndef WIFI_CONFIG_LIVENESS_PROBES_PER_MINUTE
+#define WIFI_CONFIG_LIVENESS_PROBES_PER_MINUTE 2
+#endif
+#ifndef WIFI_CONFIG_LIVENESS_TIMEOUT
+#define WIFI_CONFIG_LIVENESS_TIMEOUT 1000
+#endif
+#ifndef WIFI_CONFIG_LIVENESS_MISSES
+#define WIFI_CONFIG_LIVENESS_MISSES 3
+#endif
+#ifndef WIFI_CONFIG_EVENT_TASK_PRIORITY
+#define WIFI_CONFIG_EVENT_TASK_PRIORITY (tskIDLE_PRIORITY + 2)
+#endif
+#ifndef WIFI_CONFIG_EVENT_TASK_STACK_SIZE
+#define WIFI_CONFIG_EVENT_TASK_STACK_SIZE 4096
+#endif
+#ifndef WIFI_CONFIG_EVENT_QUEUE_LENGTH
+#define WIFI_CONFIG_EVENT_QUEUE_LENGTH 8
+#endif
+#ifndef WIFI_CONFIG_MAX_LISTENERS
+#define WIFI_CONFIG_MAX_LISTENERS 4
+#endif
+#ifndef WIFI_CONFIG_SEND_BUFFER_SIZE
+#define WIFI_CONFIG_SEND_BUFFER_SIZE 1024
+#endif
+#ifndef WIFI_CONFIG_SCAN_CACHE_SIZE
+#define WIFI_CONFIG_SCAN_CACHE_SIZE 16
+#endif
+#ifndef WIFI_CONFIG_PRESCAN_DWELL
+#define WIFI_CONFIG_PRESCAN_DWELL 40
+#endif
+#ifndef WIFI_CONFIG_SCAN_INTERVAL
+#define WIFI_CONFIG_SCAN_INTERVAL 10000
+#endif
+#ifndef WIFI_CONFIG_OTA_READ_SIZE
+#define WIFI_CONFIG_OTA_READ_SIZE 1024
+#endif
+#ifndef WIFI_CONFIG_OTA_RESTART_DELAY
+#define WIFI_CONFIG_OTA_RESTART_DELAY 1000
+#endif
+// Anyone who can reach the portal can reach /ota, so an upload has to
+// prove itself: by a shared token or by an image signature the bootloader
+// key verifies
+#if defined(WIFI_CONFIG_OTA) && !defined(WIFI_CONFIG_OTA_TOKEN) && !defined(CONFIG_SECURE_SIGNED_ON_UPDATE)
+#error "WIFI_CONFIG_OTA needs WIFI_CONFIG_OTA_TOKEN or signed app verification (CONFIG_SECURE_SIGNED_ON_UPDATE)"
+#endif
+// Per-connection deadlines: the whole header must arrive within the header
+// timeout of the request's first byte, the body within the body timeout of
+// the header's end, and the next request within the idle timeout
+#ifndef WIFI_CONFIG_HTTP_HEADER_TIMEOUT
+#define WIFI_CONFIG_HTTP_HEADER_TIMEOUT 5000
+#endif
+#ifndef WIFI_CONFIG_HTTP_BODY_TIMEOUT
+#define WIFI_CONFIG_HTTP_BODY_TIMEOUT 10000
+#endif
+#ifndef WIFI_CONFIG_HTTP_IDLE_TIMEOUT
+#define WIFI_CONFIG_HTTP_IDLE_TIMEOUT 10000
+#endif
+// Resolution of the HTTP deadlines, in ms
+#define HTTP_TIMER_TICK 100
+#ifndef WIFI_CONFIG_MAX_URL_LENGTH
+#define WIFI_CONFIG_MAX_URL_LENGTH 96
+#endif
+// Bounds on the extra keys one /provision request may store, so a portal
+// client can't fill the NVS namespace the credentials live in
+#ifndef WIFI_CONFIG_PROVISION_MAX_EXTRA
+#define WIFI_CONFIG_PROVISION_MAX_EXTRA 8
+#endif
+#ifndef WIFI_CONFIG_PROVISION_MAX_EXTRA_LENGTH
+#define WIFI_CONFIG_PROVISION_MAX_EXTRA_LENGTH 128
+#endif
+#ifndef WIFI_CONFIG_ASSET_PARTITION
+#define WIFI_CONFIG_ASSET_PARTITION "wifi_assets"
+#endif
+#ifndef WIFI_CONFIG_ASSET_MAX_AGE
+#define WIFI_CONFIG_ASSET_MAX_AGE 31536000
+#endif
+#ifndef WIFI_CONFIG_MAX_EVENT_STREAMS
+#define WIFI_CONFIG_MAX_EVENT_STREAMS 4
+#endif
+// How long portal services keep running after the last SoftAP station left
+#ifndef WIFI_CONFIG_PORTAL_PARK_DELAY
+#define WIFI_CONFIG_PORTAL_PARK_DELAY 10000
+#endif
+#ifndef WIFI_CONFIG_PORTAL_OPEN_TIME
+#define WIFI_CONFIG_PORTAL_OPEN_TIME 300000
+#endif
+#ifndef WIFI_CONFIG_PORTAL_STOP_TIMEOUT
+#define WIFI_CONFIG_PORTAL_STOP_TIMEOUT 5000
+#endif
+// Longest the portal tasks sleep before they look for a stop request.
+// Stopping the portal waits about this long on the timer service task.
+#ifndef WIFI_CONFIG_PORTAL_STOP_LATENCY
+#define WIFI_CONFIG_PORTAL_STOP_LATENCY 50
 #endif
 
 
@@ -198,8 +458,38 @@ typedef enum {
         ENDPOINT_INDEX,
         ENDPOINT_SETTINGS,
         ENDPOINT_SETTINGS_UPDATE,
+        ENDPOINT_ASSET,
+        ENDPOINT_STATUS,
+        ENDPOINT_EVENTS,
+        ENDPOINT_METRICS,
+        ENDPOINT_TRACE,
+        ENDPOINT_PROVISION,
+        ENDPOINT_OTA,
 } endpoint_t;
 
+static const metrics_endpoint_t endpoint_metrics[] = {
+        [ENDPOINT_UNKNOWN] = METRICS_ENDPOINT_OTHER,
+        [ENDPOINT_INDEX] = METRICS_ENDPOINT_INDEX,
+        [ENDPOINT_SETTINGS] = METRICS_ENDPOINT_SETTINGS,
+        [ENDPOINT_SETTINGS_UPDATE] = METRICS_ENDPOINT_SETTINGS_UPDATE,
+        [ENDPOINT_ASSET] = METRICS_ENDPOINT_ASSET,
+        [ENDPOINT_STATUS] = METRICS_ENDPOINT_STATUS,
+        [ENDPOINT_EVENTS] = METRICS_ENDPOINT_EVENTS,
+        [ENDPOINT_METRICS] = METRICS_ENDPOINT_METRICS,
+        [ENDPOINT_TRACE] = METRICS_ENDPOINT_OTHER,
+        [ENDPOINT_PROVISION] = METRICS_ENDPOINT_PROVISION,
+        [ENDPOINT_OTA] = METRICS_ENDPOINT_OTA,
+};
+
+
+// Submitted credentials are tried first and only saved once they work
+typedef enum {
+        TRIAL_IDLE = 0,
+        TRIAL_CONNECTING,
+        TRIAL_CONNECTED,
+        TRIAL_FAILED,
+} trial_state_t;
+
 
 typedef struct {
         char *ssid_prefix;
@@ -208,33 +498,181 @@ typedef struct {
         void (*on_wifi_ready)(); // deprecated
         void (*on_event)(wifi_config_event_t);
 
-        int first_time;
+        // Monitor and connect timer decisions, see provision_fsm.c
+        provision_state_t provision;
         TimerHandle_t network_monitor_timer;
+        // Application callbacks run on their own task, never on the timer
+        // service task or the event loop
+        TaskHandle_t event_task_handle;
+        QueueHandle_t event_queue;
         TaskHandle_t http_task_handle;
         TaskHandle_t dns_task_handle;
+        TaskHandle_t scan_task_handle;
+        // Set while the scan task sweeps, so a stop can cut the sweep short
+        volatile bool portal_scan_running;
+        EventGroupHandle_t portal_events;
+        QueueHandle_t portal_event_queue;
+        // The SoftAP runs alone until a station joins; DNS, HTTP and scans
+        // only run while someone can use them
+        bool portal_services_running;
+        TimerHandle_t portal_park_timer;
+        // Portal raised by wifi_config_portal_open() next to the connection,
+        // esp_timer time it closes at or 0
+        int64_t portal_open_until;
+        // The pre-scan holds radio_lock from its start until
+        // wifi_config_prescan_done() brings the AP up
+        volatile bool prescan_pending;
+        int64_t prescan_started;
+
+        // Connect attempts are serialized with scans through radio_lock and
+        // deferred while an HTTP request is being served. A binary semaphore
+        // rather than a mutex: a roaming scan takes it on the esp_timer task
+        // and its SCAN_DONE gives it back on the event loop.
+        SemaphoreHandle_t radio_lock;
+        esp_timer_handle_t connect_timer;
+        // Set by wifi_config_connect_now(): new credentials replace an
+        // attempt in flight instead of waiting for it
+        volatile bool connect_preempt;
+        volatile int http_requests_in_flight;
+        // Client deadlines, owned by the HTTP task
+        timer_wheel_t *http_timers;
+
+        // Connected-mode RSSI supervision
+        esp_timer_handle_t roaming_timer;
+        roaming_state_t roaming;
+        volatile bool roaming_scan_pending;
+
+        // Gateway liveness probing, a probe is in flight while
+        // liveness_probe_sent is set
+        esp_timer_handle_t liveness_timer;
+        liveness_config_t liveness_config;
+        liveness_state_t liveness;
+        int liveness_fd;
+        uint16_t liveness_probe_id;
+        bool liveness_probe_sent;
+
+        SemaphoreHandle_t trial_lock;
+        esp_timer_handle_t trial_timer;
+        trial_state_t trial_state;
+        uint8_t trial_reason;
+        char *trial_ssid;
+        char *trial_password;
+        char *trial_static_ip;
 } wifi_config_context_t;
 
 
+// Portal tasks set their bit and park themselves when they are done, so
+// wifi_config_softap_stop() can delete them and reclaim their stacks at once
+#define PORTAL_HTTP_STOPPED (1 << 0)
+#define PORTAL_DNS_STOPPED (1 << 1)
+#define PORTAL_SCAN_STOPPED (1 << 2)
+#define PORTAL_ALL_STOPPED (PORTAL_HTTP_STOPPED | PORTAL_DNS_STOPPED | PORTAL_SCAN_STOPPED)
+
+
 static wifi_config_context_t *context = NULL;
 
+static const provision_config_t provision_config = {
+        .backoff_min = WIFI_CONFIG_CONNECT_BACKOFF_MIN,
+        .backoff_max = WIFI_CONFIG_CONNECT_BACKOFF_MAX,
+        .connected_interval = WIFI_CONFIG_CONNECTED_MONITOR_INTERVAL,
+        .disconnected_interval = WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL,
+        .grace = WIFI_CONFIG_PORTAL_GRACE,
+        .grace_max = WIFI_CONFIG_PORTAL_GRACE_MAX,
+        .stable_time = WIFI_CONFIG_STABLE_TIME,
+};
+
+typedef enum {
+        OTA_NONE = 0,
+        // This client owns the running upload; its body goes to flash
+        OTA_RECEIVING,
+        // The upload could not start or broke off; the rest of the body
+        // is read and dropped so the client still gets its answer
+        OTA_FAILED,
+        // Same, for a client that didn't present the upload token
+        OTA_DENIED,
+} ota_state_t;
+
+typedef enum {
+        HEADER_IF_NONE_MATCH = 0,
+        HEADER_AUTHORIZATION,
+        HEADER_OTHER,
+} header_t;
+
+// Request headers the server reads, lowercase. Their first letters differ,
+// which is what picks the one a header name is matched against.
+static const char *const http_headers[] = {
+        [HEADER_IF_NONE_MATCH] = "if-none-match",
+        [HEADER_AUTHORIZATION] = "authorization",
+};
+
 typedef struct _client {
         int fd;
         bool disconnected;
+        timer_wheel_entry_t deadline;
 
         http_parser parser;
         endpoint_t endpoint;
         uint8_t *body;
         size_t body_length;
 
+        // URL and header names/values can arrive split over several reads
+        char url[WIFI_CONFIG_MAX_URL_LENGTH];
+        size_t url_length;
+        header_t header;
+        size_t header_match;
+        bool header_value;
+        char if_none_match[12];
+        size_t if_none_match_length;
+#ifdef WIFI_CONFIG_OTA_TOKEN
+        char authorization[sizeof("Bearer " WIFI_CONFIG_OTA_TOKEN) - 1];
+        size_t authorization_length;
+#endif
+
+        asset_t asset;
+        bool in_request;
+        int64_t request_started;
+        ota_state_t ota;
+        // Set once the response turned into an event stream; the HTTP task
+        // then moves the socket to a lightweight event_stream_t
+        bool event_stream;
+
+        // Responses are rendered into the HTTP task's send buffer, which is
+        // shared by all clients since handlers always flush before returning
+        template_output_t output;
+
         struct _client *next;
 } client_t;
 
 
 static int wifi_config_has_configuration();
 static int wifi_config_station_connect();
+static void wifi_config_connect_schedule();
+static void wifi_config_connect_now();
 static void wifi_config_softap_start();
 static void wifi_config_softap_stop();
 
+
+// A client that switched to text/event-stream. It only needs its socket.
+typedef struct _event_stream {
+        int fd;
+        struct _event_stream *next;
+} event_stream_t;
+
+
+static void wifi_config_portal_event(portal_event_type_t type, uint32_t value) {
+        if (!context || !context->portal_event_queue)
+                return;
+
+        portal_event_t event = { .type = type, .value = value };
+        xQueueSend(context->portal_event_queue, &event, 0);
+}
+
+
+static void portal_task_exit(EventBits_t stopped_bit) {
+        xEventGroupSetBits(context->portal_events, stopped_bit);
+        vTaskSuspend(NULL);
+}
+
 static client_t *client_new() {
         client_t *client = malloc(sizeof(client_t));
         memset(client, 0, sizeof(client_t));
@@ -246,45 +684,49 @@ static client_t *client_new() {
 }
 
 
-static void client_free(client_t *client) {
-        if (client->body)
-                free(client->body);
-
-        free(client);
+static void client_request_done(client_t *client) {
+        if (client->in_request) {
+                client->in_request = false;
+                context->http_requests_in_flight--;
+        }
 }
 
 
-static void client_send(client_t *client, const char *payload, size_t payload_size) {
-        lwip_write(client->fd, payload, payload_size);
+static uint32_t http_timer_now() {
+        return esp_timer_get_time() / (HTTP_TIMER_TICK * 1000);
 }
-static void client_send_index(client_t *client) {
-        ESP_LOGI("wifi_config", "Serving captive portal response");
-        extern const uint8_t index_html_start[] asm ("_binary_index_html_start");
-        extern const uint8_t index_html_end[] asm ("_binary_index_html_end");
 
-        const char *header =
-                "HTTP/1.1 200 OK\r\n"
-                "Content-Type: text/html\r\n"
-                "Cache-Control: no-cache\r\n"
-                "Connection: close\r\n"
-                "\r\n";
 
-        client_send(client, header, strlen(header));
-        client_send(client, (const char *)index_html_start, index_html_end - index_html_start);
+static void client_set_deadline(client_t *client, uint32_t timeout) {
+        timer_wheel_schedule(context->http_timers, &client->deadline,
+                             http_timer_now() + (timeout + HTTP_TIMER_TICK - 1) / HTTP_TIMER_TICK);
 }
 
 
+static void client_free(client_t *client) {
+        client_request_done(client);
+        timer_wheel_cancel(context->http_timers, &client->deadline);
+
+        if (client->ota == OTA_RECEIVING)
+                ota_upload_abort();
+
+        if (client->body)
+                free(client->body);
 
+        free(client);
+}
 
 
+static void client_send(client_t *client, const char *payload, size_t payload_size) {
+        TRACE_BEGIN(TRACE_HTTP_SEND, payload_size);
+        int sent = lwip_write(client->fd, payload, payload_size);
+        TRACE_END(TRACE_HTTP_SEND, sent);
+        if (sent > 0)
+                metrics_add(METRIC_HTTP_BYTES_SENT, sent);
+}
 
-static void client_send_chunk(client_t *client, const char *payload) {
-        int len = strlen(payload);
-        char buffer[10];
-        int buffer_len = snprintf(buffer, sizeof(buffer), "%x\r\n", len);
-        client_send(client, buffer, buffer_len);
-        client_send(client, payload, len);
-        client_send(client, "\r\n", 2);
+static void client_output_flush(void *arg, const char *data, size_t length) {
+        client_send((client_t *) arg, data, length);
 }
 
 
@@ -299,120 +741,427 @@ static void client_send_redirect(client_t *client, int code, const char *redirec
 typedef struct _wifi_network_info {
         char ssid[33];
         bool secure;
+        // Of the strongest BSS seen with this SSID
+        uint8_t channel;
+        int8_t rssi;
 
         struct _wifi_network_info *next;
 } wifi_network_info_t;
 
 
-wifi_network_info_t *wifi_networks = NULL;
-SemaphoreHandle_t wifi_networks_mutex;
+static wifi_network_info_t *wifi_networks = NULL;
+static SemaphoreHandle_t wifi_networks_mutex = NULL;
+// Least congested SoftAP channel by the last scan, 0 if unknown
+static uint8_t wifi_networks_quiet_channel = 0;
+// When the list was last replaced by a scan, 0 if it only holds cached data
+static int64_t wifi_networks_updated = 0;
+
+
+static void wifi_networks_free() {
+        wifi_network_info_t *wifi_network = wifi_networks;
+        while (wifi_network) {
+                wifi_network_info_t *next = wifi_network->next;
+                free(wifi_network);
+                wifi_network = next;
+        }
+        wifi_networks = NULL;
+}
+
+
+static wifi_network_info_t *wifi_networks_find(const char *ssid) {
+        for (wifi_network_info_t *net = wifi_networks; net; net = net->next) {
+                if (!strncmp(net->ssid, ssid, sizeof(net->ssid)))
+                        return net;
+        }
+        return NULL;
+}
+
+
+static wifi_network_info_t *wifi_networks_add(const char *ssid, bool secure, uint8_t channel, int8_t rssi) {
+        wifi_network_info_t *net = wifi_networks_find(ssid);
+        if (net) {
+                if (rssi > net->rssi) {
+                        net->channel = channel;
+                        net->rssi = rssi;
+                }
+                return net;
+        }
+
+        net = malloc(sizeof(wifi_network_info_t));
+        if (!net)
+                return NULL;
+        memset(net, 0, sizeof(*net));
+        strncpy(net->ssid, ssid, sizeof(net->ssid) - 1);
+        net->secure = secure;
+        net->channel = channel;
+        net->rssi = rssi;
+        net->next = wifi_networks;
+        wifi_networks = net;
+
+        return net;
+}
+
+
+// The last scan result survives software resets in RTC memory, so a portal
+// raised right after a reboot has a network list before its first scan.
+typedef struct {
+        uint32_t magic;
+        uint32_t crc;
+        uint8_t count;
+        uint8_t quiet_channel;
+        struct {
+                char ssid[33];
+                bool secure;
+                uint8_t channel;
+                int8_t rssi;
+        } networks[WIFI_CONFIG_SCAN_CACHE_SIZE];
+} scan_cache_t;
+
+#define SCAN_CACHE_MAGIC 0x57435343
+
+static RTC_NOINIT_ATTR scan_cache_t scan_cache;
+
+
+static uint32_t scan_cache_crc() {
+        return esp_rom_crc32_le(0, (const uint8_t *) &scan_cache.count,
+                                sizeof(scan_cache) - offsetof(scan_cache_t, count));
+}
+
+
+static void scan_cache_store() {
+        memset(&scan_cache, 0, sizeof(scan_cache));
+        for (wifi_network_info_t *net = wifi_networks;
+             net && scan_cache.count < WIFI_CONFIG_SCAN_CACHE_SIZE; net = net->next) {
+                memcpy(scan_cache.networks[scan_cache.count].ssid, net->ssid, sizeof(net->ssid));
+                scan_cache.networks[scan_cache.count].secure = net->secure;
+                scan_cache.networks[scan_cache.count].channel = net->channel;
+                scan_cache.networks[scan_cache.count].rssi = net->rssi;
+                scan_cache.count++;
+        }
+        scan_cache.quiet_channel = wifi_networks_quiet_channel;
+        scan_cache.crc = scan_cache_crc();
+        scan_cache.magic = SCAN_CACHE_MAGIC;
+}
+
+
+// Call with wifi_networks_mutex held
+static void scan_cache_load() {
+        if (scan_cache.magic != SCAN_CACHE_MAGIC || scan_cache.count > WIFI_CONFIG_SCAN_CACHE_SIZE ||
+            scan_cache.crc != scan_cache_crc())
+                return;
+
+        // Added in reverse so the list keeps the order it was stored in
+        for (int i = scan_cache.count - 1; i >= 0; i--) {
+                scan_cache.networks[i].ssid[sizeof(scan_cache.networks[i].ssid) - 1] = 0;
+                wifi_networks_add(scan_cache.networks[i].ssid, scan_cache.networks[i].secure,
+                                  scan_cache.networks[i].channel, scan_cache.networks[i].rssi);
+        }
+        wifi_networks_quiet_channel = scan_cache.quiet_channel;
+        DEBUG("Loaded %d cached networks", scan_cache.count);
+}
+
+
+// Replaces the network list with the result of the scan that just finished
+static int wifi_networks_update_from_scan(uint16_t ap_num) {
+        wifi_ap_record_t *records = calloc(ap_num ? ap_num : 1, sizeof(wifi_ap_record_t));
+        if (!records || esp_wifi_scan_get_ap_records(&ap_num, records) != ESP_OK) {
+                free(records);
+                return -1;
+        }
+
+        xSemaphoreTake(wifi_networks_mutex, portMAX_DELAY);
+
+        wifi_networks_free();
+
+        // Records come strongest first; adding them in reverse keeps that
+        // order in the list, which is also what the cache keeps
+        ap_channel_load_t load;
+        ap_channel_load_reset(&load);
+        for (int i = ap_num - 1; i >= 0; i--) {
+                wifi_networks_add((char *)records[i].ssid, records[i].authmode != WIFI_AUTH_OPEN,
+                                  records[i].primary, records[i].rssi);
+                ap_channel_load_add(&load, records[i].primary, records[i].rssi);
+        }
+        wifi_networks_quiet_channel = ap_num ? ap_channel_load_best(&load) : 0;
+        wifi_networks_updated = esp_timer_get_time();
+
+        scan_cache_store();
+
+        xSemaphoreGive(wifi_networks_mutex);
+
+        free(records);
+        return 0;
+}
+
+
+// A quick active scan in pure station mode, before the SoftAP is up: there
+// are no portal clients yet whose traffic channel hopping could disturb.
+// It runs in the background, so the timer service task doesn't sit out the
+// channel sweep; wifi_config_prescan_done() brings the AP up once it ends.
+static bool wifi_config_prescan_start() {
+        // Next to a working connection the sweep would pull the station off
+        // its channel, and the AP has to share that channel anyway
+        if (sta_got_ip || sta_connecting || xSemaphoreTake(context->radio_lock, 0) != pdTRUE)
+                return false;
+
+        wifi_scan_config_t scan_config = {
+                .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+                .scan_time.active = { .min = 0, .max = WIFI_CONFIG_PRESCAN_DWELL },
+        };
+
+        TRACE_BEGIN(TRACE_SCAN, 1);
+        esp_err_t result = esp_wifi_scan_start(&scan_config, false);
+        if (result != ESP_OK) {
+                TRACE_END(TRACE_SCAN, 0);
+                xSemaphoreGive(context->radio_lock);
+                DEBUG("Pre-scan failed: %s", esp_err_to_name(result));
+                return false;
+        }
+
+        context->prescan_started = esp_timer_get_time();
+        context->prescan_pending = true;
+        return true;
+}
 
 
 static void wifi_scan_task(void *arg)
 {
         INFO("Starting WiFi scan");
+
+        if (arg) {
+                uint32_t task_value = 0;
+                if (xTaskNotifyWait(0, 1, &task_value, WIFI_CONFIG_SCAN_INTERVAL / portTICK_PERIOD_MS) == pdTRUE &&
+                    task_value) {
+                        portal_task_exit(PORTAL_SCAN_STOPPED);
+                        return;
+                }
+        }
+
         while (true) {
                 if (sdk_wifi_get_opmode() != STATIONAP_MODE)
                         break;
 
+                // Wait for the radio without missing a stop request
+                if (xSemaphoreTake(context->radio_lock, pdMS_TO_TICKS(WIFI_CONFIG_PORTAL_STOP_LATENCY)) != pdTRUE) {
+                        uint32_t task_value = 0;
+                        if (xTaskNotifyWait(0, 1, &task_value, 0) == pdTRUE && task_value)
+                                break;
+                        continue;
+                }
+
+                // Leave the radio to a running connect attempt
+                if (sta_connecting &&
+                    esp_timer_get_time() - sta_connect_started < WIFI_CONFIG_CONNECT_ATTEMPT_TIME * 1000LL) {
+                        xSemaphoreGive(context->radio_lock);
+
+                        uint32_t task_value = 0;
+                        if (xTaskNotifyWait(0, 1, &task_value, 1000 / portTICK_PERIOD_MS) == pdTRUE && task_value)
+                                break;
+                        continue;
+                }
+
+                int64_t scan_started = esp_timer_get_time();
+                TRACE_BEGIN(TRACE_SCAN, 0);
+                context->portal_scan_running = true;
                 esp_wifi_scan_start(NULL, true);
+                context->portal_scan_running = false;
+                xSemaphoreGive(context->radio_lock);
 
                 uint16_t ap_num = 0;
                 esp_wifi_scan_get_ap_num(&ap_num);
-                wifi_ap_record_t *records = calloc(ap_num, sizeof(wifi_ap_record_t));
-                if (records && esp_wifi_scan_get_ap_records(&ap_num, records) == ESP_OK) {
-                        xSemaphoreTake(wifi_networks_mutex, portMAX_DELAY);
-
-                        wifi_network_info_t *wifi_network = wifi_networks;
-                        while (wifi_network) {
-                                wifi_network_info_t *next = wifi_network->next;
-                                free(wifi_network);
-                                wifi_network = next;
-                        }
-                        wifi_networks = NULL;
-
-                        for (int i = 0; i < ap_num; i++) {
-                                wifi_network_info_t *net = wifi_networks;
-                                while (net) {
-                                        if (!strncmp(net->ssid, (char *)records[i].ssid, sizeof(net->ssid)))
-                                                break;
-                                        net = net->next;
-                                }
-                                if (!net) {
-                                        wifi_network_info_t *net = malloc(sizeof(wifi_network_info_t));
-                                        memset(net, 0, sizeof(*net));
-                                        strncpy(net->ssid, (char *)records[i].ssid, sizeof(net->ssid));
-                                        net->secure = records[i].authmode != WIFI_AUTH_OPEN;
-                                        net->next = wifi_networks;
-                                        wifi_networks = net;
-                                }
-                        }
+                TRACE_END(TRACE_SCAN, ap_num);
 
-                        xSemaphoreGive(wifi_networks_mutex);
+                // A stop request may have cut the sweep short, keep the list
+                // from the last complete one
+                uint32_t stop_value = 0;
+                if (xTaskNotifyWait(0, 1, &stop_value, 0) == pdTRUE && stop_value) {
+                        esp_wifi_clear_ap_list();
+                        break;
                 }
+                metrics_scan_done((esp_timer_get_time() - scan_started) / 1000, ap_num);
+                if (!wifi_networks_update_from_scan(ap_num))
+                        wifi_config_portal_event(PORTAL_EVENT_SCAN_UPDATED, ap_num);
 
-                free(records);
-                vTaskDelay(10000 / portTICK_PERIOD_MS);
+                uint32_t task_value = 0;
+                if (xTaskNotifyWait(0, 1, &task_value, WIFI_CONFIG_SCAN_INTERVAL / portTICK_PERIOD_MS) == pdTRUE) {
+                        if (task_value)
+                                break;
+                }
         }
 
-        xSemaphoreTake(wifi_networks_mutex, portMAX_DELAY);
+        INFO("Stopping WiFi scan");
 
-        wifi_network_info_t *wifi_network = wifi_networks;
-        while (wifi_network) {
-                wifi_network_info_t *next = wifi_network->next;
-                free(wifi_network);
-                wifi_network = next;
+        portal_task_exit(PORTAL_SCAN_STOPPED);
+}
+
+// Slots and lists referenced by the compiled template in index.html.h
+enum {
+        TEMPLATE_VALUE_CUSTOM_HTML,
+        TEMPLATE_VALUE_NETWORK_SSID,
+        TEMPLATE_VALUE_NETWORK_SECURE,
+};
+
+enum {
+        TEMPLATE_LIST_NETWORKS,
+};
+
+#include "index.html.h"
+
+
+static const char *wifi_config_template_value(uint8_t slot, const void *item, void *arg) {
+        const wifi_network_info_t *net = item;
+        switch (slot) {
+        case TEMPLATE_VALUE_CUSTOM_HTML: return context->custom_html;
+        case TEMPLATE_VALUE_NETWORK_SSID: return net ? net->ssid : NULL;
+        default: return NULL;
         }
-        wifi_networks = NULL;
+}
 
-        xSemaphoreGive(wifi_networks_mutex);
 
-        vTaskDelete(NULL);
+static bool wifi_config_template_test(uint8_t slot, const void *item, void *arg) {
+        const wifi_network_info_t *net = item;
+        switch (slot) {
+        case TEMPLATE_VALUE_NETWORK_SECURE: return net && net->secure;
+        default: {
+                const char *value = wifi_config_template_value(slot, item, arg);
+                return value && value[0];
+        }
+        }
+}
+
+
+static const void *wifi_config_template_next(uint8_t list, const void *item, void *arg) {
+        const bool *networks_locked = arg;
+        switch (list) {
+        case TEMPLATE_LIST_NETWORKS:
+                if (!*networks_locked)
+                        return NULL;
+                return item ? ((const wifi_network_info_t *) item)->next : wifi_networks;
+        default:
+                return NULL;
+        }
 }
 
-#include "index.html.h"
 
 static void wifi_config_server_on_settings(client_t *client) {
-        static const char http_prologue[] =
+        // Without the network list lock the page is rendered with no networks.
+        // The lock is held across measuring and rendering, so Content-Length
+        // matches the body exactly.
+        bool networks_locked = xSemaphoreTake(wifi_networks_mutex, 5000 / portTICK_PERIOD_MS);
+        template_data_t template_data = {
+                .value = wifi_config_template_value,
+                .test = wifi_config_template_test,
+                .next = wifi_config_template_next,
+                .arg = &networks_locked,
+        };
+
+        size_t content_length = template_measure(html_settings_template, &template_data);
+
+        char prologue[128];
+        int prologue_length = snprintf(
+                prologue, sizeof(prologue),
                 "HTTP/1.1 200 \r\n"
                 "Content-Type: text/html; charset=utf-8\r\n"
                 "Cache-Control: no-store\r\n"
-                "Transfer-Encoding: chunked\r\n"
-                "Connection: close\r\n"
-                "\r\n";
-
-        client_send(client, http_prologue, sizeof(http_prologue)-1);
-        client_send_chunk(client, html_settings_header);
-
-        if (context->custom_html != NULL && context->custom_html[0] > 0) {
-                uint8_t buffer_size = strlen(html_settings_custom_html) + strlen(context->custom_html);
-                char* buffer = (char*) calloc(buffer_size, sizeof(char)); //fill up the buffer with zeros
-                snprintf(buffer, buffer_size, html_settings_custom_html, context->custom_html); //fill in template with the custom_html content
-                client_send_chunk(client, buffer);
-                free(buffer);
-        }
-
-        client_send_chunk(client, html_settings_body);
-
-        if (xSemaphoreTake(wifi_networks_mutex, 5000 / portTICK_PERIOD_MS)) {
-                char buffer[64];
-                wifi_network_info_t *net = wifi_networks;
-                while (net) {
-                        snprintf(
-                                buffer, sizeof(buffer),
-                                html_network_item,
-                                net->secure ? "secure" : "unsecure", net->ssid
-                                );
-                        client_send_chunk(client, buffer);
-
-                        net = net->next;
-                }
+                "Content-Length: %u\r\n"
+                "\r\n",
+                (unsigned) content_length);
+
+        template_write(&client->output, prologue, prologue_length);
+        template_render(&client->output, html_settings_template, &template_data);
+        template_flush(&client->output);
 
+        if (networks_locked)
                 xSemaphoreGive(wifi_networks_mutex);
-        }
+}
 
-        client_send_chunk(client, html_settings_footer);
-        client_send_chunk(client, "");
+
+static void wifi_config_trial_start(const char *ssid, const char *password, const char *static_ip);
+static void wifi_config_trial_cancel();
+static bool static_ip_parse(const char *text, esp_netif_ip_info_t *info, esp_ip4_addr_t *dns);
+static void wifi_config_save(const char *ssid, const char *password, const char *static_ip);
+
+
+static void wifi_config_server_on_status(client_t *client) {
+        static const char *states[] = {
+                [TRIAL_IDLE] = "idle",
+                [TRIAL_CONNECTING] = "connecting",
+                [TRIAL_CONNECTED] = "connected",
+                [TRIAL_FAILED] = "failed",
+        };
+
+        char body[64];
+        int body_length = snprintf(body, sizeof(body), "{\"state\":\"%s\",\"reason\":%d}",
+                                   states[context->trial_state], context->trial_reason);
+
+        char header[128];
+        int header_length = snprintf(
+                header, sizeof(header),
+                "HTTP/1.1 200 \r\n"
+                "Content-Type: application/json\r\n"
+                "Cache-Control: no-store\r\n"
+                "Content-Length: %d\r\n"
+                "\r\n",
+                body_length);
+
+        template_write(&client->output, header, header_length);
+        template_write(&client->output, body, body_length);
+        template_flush(&client->output);
+}
+
+
+static void wifi_config_server_on_metrics(client_t *client) {
+        // Counters keep moving, measure and render the same snapshot
+        metrics_snapshot_t snapshot;
+        metrics_snapshot(&snapshot);
+
+        template_output_t counter = {0};
+        metrics_render(&counter, &snapshot);
+
+        char header[160];
+        int header_length = snprintf(
+                header, sizeof(header),
+                "HTTP/1.1 200 \r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Cache-Control: no-store\r\n"
+                "Content-Length: %u\r\n"
+                "\r\n",
+                (unsigned) counter.length);
+
+        template_write(&client->output, header, header_length);
+        metrics_render(&client->output, &snapshot);
+        template_flush(&client->output);
+}
+
+
+#ifdef WIFI_CONFIG_TRACE
+static void wifi_config_server_on_trace(client_t *client) {
+        uint32_t head;
+        char header[160];
+        int header_length = snprintf(
+                header, sizeof(header),
+                "HTTP/1.1 200 \r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Cache-Control: no-store\r\n"
+                "Content-Length: %u\r\n"
+                "\r\n",
+                (unsigned) trace_dump_measure(&head));
+
+        template_write(&client->output, header, header_length);
+        trace_dump(&client->output, head);
+}
+#endif
+
+
+static void wifi_config_server_on_events(client_t *client) {
+        static const char payload[] =
+                "HTTP/1.1 200 \r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-store\r\n"
+                "\r\n"
+                "retry: 2000\n\n";
+        client_send(client, payload, sizeof(payload)-1);
+        client->event_stream = true;
 }
 
 
@@ -428,53 +1177,474 @@ static void wifi_config_server_on_settings_update(client_t *client) {
 
         form_param_t *ssid_param = form_params_find(form, "ssid");
         form_param_t *password_param = form_params_find(form, "password");
-        if (!ssid_param) {
+        form_param_t *static_ip_param = form_params_find(form, "static_ip");
+        const char *static_ip = static_ip_param && static_ip_param->value && *static_ip_param->value ?
+                                static_ip_param->value : NULL;
+        esp_netif_ip_info_t ip_info;
+        esp_ip4_addr_t dns;
+        if (!ssid_param || !ssid_param->value || !*ssid_param->value ||
+            strlen(ssid_param->value) > 32 ||
+            (static_ip && !static_ip_parse(static_ip, &ip_info, &dns))) {
                 DEBUG("Invalid form data, redirecting to /settings");
                 form_params_free(form);
                 client_send_redirect(client, 302, "/settings");
                 return;
         }
 
-        static const char payload[] = "HTTP/1.1 204 \r\nContent-Type: text/html\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        static const char payload[] = "HTTP/1.1 202 \r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n";
         client_send(client, payload, sizeof(payload)-1);
 
-        DEBUG("Setting wifi_ssid param = %s", ssid_param->value);
-        DEBUG("Setting wifi_password param = %s", password_param->value);
+        DEBUG("Trying wifi_ssid = %s", ssid_param->value);
 
-        sysparam_set_string("wifi_ssid", ssid_param->value);
-        if (password_param) {
-                sysparam_set_string("wifi_password", password_param->value);
-        } else {
-                sysparam_set_string("wifi_password", "");
-        }
+        wifi_config_event_info_t info = { .event = WIFI_CONFIG_CREDENTIALS_RECEIVED };
+        strncpy(info.credentials.ssid, ssid_param->value, sizeof(info.credentials.ssid) - 1);
+        wifi_config_event_emit(&info);
+
+        wifi_config_trial_start(ssid_param->value, password_param ? password_param->value : NULL, static_ip);
         form_params_free(form);
+}
 
-        vTaskDelay(500 / portTICK_PERIOD_MS);
 
-        wifi_config_station_connect();
+// Extra keys share the NVS namespace with the credentials, so they must be
+// valid NVS keys and stay clear of the wifi_ prefix
+static bool provision_extra_key_valid(const char *key) {
+        size_t length = strlen(key);
+        if (!length || length > 15 || !strncmp(key, "wifi_", 5))
+                return false;
+
+        for (const char *c = key; *c; c++) {
+                if (!isalnum((unsigned char) *c) && *c != '_')
+                        return false;
+        }
+        return true;
 }
 
 
-static int wifi_config_server_on_url(http_parser *parser, const char *data, size_t length) {
-        client_t *client = (client_t*) parser->data;
+// Machine provisioning: a single form-urlencoded POST with ssid, optional
+// password, optional static_ip, optional commit=1 and any extra keys, acknowledged in a few
+// bytes. Without commit the credentials go through the same trial as the
+// settings form; with it they are saved right away, for units provisioned
+// out of range of the target network.
+static void wifi_config_server_on_provision(client_t *client) {
+        static const char accepted[] =
+                "HTTP/1.1 202 \r\nContent-Type: text/plain\r\nContent-Length: 3\r\n\r\nOK\n";
+        static const char rejected[] =
+                "HTTP/1.1 400 \r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nERR\n";
+
+        form_param_t *form = client->body ? form_params_parse((char *)client->body) : NULL;
+        form_param_t *ssid_param = form ? form_params_find(form, "ssid") : NULL;
+        if (!ssid_param || !ssid_param->value || !*ssid_param->value ||
+            strlen(ssid_param->value) > 32) {
+                client_send(client, rejected, sizeof(rejected)-1);
+                form_params_free(form);
+                return;
+        }
+
+        form_param_t *password_param = form_params_find(form, "password");
+        form_param_t *commit_param = form_params_find(form, "commit");
+        bool commit = commit_param && commit_param->value && !strcmp(commit_param->value, "1");
+        form_param_t *static_ip_param = form_params_find(form, "static_ip");
+        const char *static_ip = static_ip_param && static_ip_param->value && *static_ip_param->value ?
+                                static_ip_param->value : NULL;
+        esp_netif_ip_info_t ip_info;
+        esp_ip4_addr_t dns;
+        if (static_ip && !static_ip_parse(static_ip, &ip_info, &dns)) {
+                client_send(client, rejected, sizeof(rejected)-1);
+                form_params_free(form);
+                return;
+        }
+
+        int extra_count = 0;
+        for (form_param_t *param = form; param; param = param->next) {
+                if (!strcmp(param->name, "ssid") || !strcmp(param->name, "password") ||
+                    !strcmp(param->name, "commit") || !strcmp(param->name, "static_ip"))
+                        continue;
+                if (!provision_extra_key_valid(param->name) || ++extra_count > WIFI_CONFIG_PROVISION_MAX_EXTRA ||
+                    (param->value && strlen(param->value) > WIFI_CONFIG_PROVISION_MAX_EXTRA_LENGTH)) {
+                        client_send(client, rejected, sizeof(rejected)-1);
+                        form_params_free(form);
+                        return;
+                }
+        }
+
+        client_send(client, accepted, sizeof(accepted)-1);
+
+        for (form_param_t *param = form; param; param = param->next) {
+                if (strcmp(param->name, "ssid") && strcmp(param->name, "password") &&
+                    strcmp(param->name, "commit") && strcmp(param->name, "static_ip"))
+                        sysparam_set_string(param->name, param->value);
+        }
+
+        const char *password = password_param ? password_param->value : NULL;
+        INFO("Provisioned %s%s", ssid_param->value, commit ? " (committed)" : "");
+
+        wifi_config_event_info_t info = { .event = WIFI_CONFIG_CREDENTIALS_RECEIVED };
+        strncpy(info.credentials.ssid, ssid_param->value, sizeof(info.credentials.ssid) - 1);
+        wifi_config_event_emit(&info);
+
+        if (commit) {
+                wifi_config_trial_cancel();
+                wifi_config_save(ssid_param->value, password, static_ip);
+                wifi_config_connect_now();
+        } else {
+                wifi_config_trial_start(ssid_param->value, password, static_ip);
+        }
+
+        form_params_free(form);
+}
+
+
+#ifdef WIFI_CONFIG_OTA
+static void wifi_config_ota_restart(void *arg) {
+        INFO("Restarting into new firmware");
+        async_log_flush(500);
+        esp_restart();
+}
+
+
+static int hex_digit(char c) {
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        c = tolower((unsigned char) c);
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        return -1;
+}
+
+
+// Digest the client expects, from an optional sha256=<hex> query parameter.
+// Returns -1 if the parameter is malformed, 1 if found and 0 if absent.
+static int ota_expected_sha256(client_t *client, uint8_t *sha256) {
+        static const char param[] = "sha256=";
+
+        const char *query = memchr(client->url, '?', client->url_length);
+        if (!query)
+                return 0;
+
+        const char *end = client->url + client->url_length;
+        for (const char *p = query + 1; p < end; ) {
+                const char *next = memchr(p, '&', end - p);
+                if (!next)
+                        next = end;
+
+                if (next - p > sizeof(param) - 1 && !memcmp(p, param, sizeof(param) - 1)) {
+                        p += sizeof(param) - 1;
+                        if (next - p != 64)
+                                return -1;
+                        for (int i = 0; i < 32; i++) {
+                                int high = hex_digit(p[i*2]), low = hex_digit(p[i*2 + 1]);
+                                if (high < 0 || low < 0)
+                                        return -1;
+                                sha256[i] = (high << 4) | low;
+                        }
+                        return 1;
+                }
+
+                p = next + 1;
+        }
+        return 0;
+}
+
+
+// Uploads need the token as "Authorization: Bearer <token>". Builds without
+// one rely on the bootloader's signing key instead: esp_ota_end() then
+// refuses any image that isn't signed with it.
+static bool ota_authorized(client_t *client) {
+#ifdef WIFI_CONFIG_OTA_TOKEN
+        static const char expected[] = "Bearer " WIFI_CONFIG_OTA_TOKEN;
+        if (client->authorization_length != sizeof(expected) - 1)
+                return false;
+
+        // Compare all of it, so the time taken doesn't tell how much matched
+        uint8_t diff = 0;
+        for (size_t i = 0; i < sizeof(expected) - 1; i++)
+                diff |= client->authorization[i] ^ expected[i];
+        return !diff;
+#else
+        return true;
+#endif
+}
+
+
+// Firmware upload: the raw image as the request body, streamed into the
+// inactive OTA partition as it arrives. The device restarts into it once
+// the image verified and the response went out.
+static void wifi_config_server_on_ota(client_t *client) {
+        static const char rejected[] =
+                "HTTP/1.1 400 \r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nERR\n";
+        static const char unauthorized[] =
+                "HTTP/1.1 401 \r\nWWW-Authenticate: Bearer\r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nERR\n";
+        static const char failed[] =
+                "HTTP/1.1 500 \r\nContent-Type: text/plain\r\nContent-Length: 4\r\n\r\nERR\n";
+
+        if (client->ota == OTA_DENIED) {
+                client_send(client, unauthorized, sizeof(unauthorized)-1);
+                return;
+        }
+        if (client->ota != OTA_RECEIVING) {
+                client_send(client, failed, sizeof(failed)-1);
+                return;
+        }
+
+        uint8_t expected[32];
+        int has_expected = ota_expected_sha256(client, expected);
+        if (has_expected < 0) {
+                int status = ota_upload_abort();
+                client->ota = OTA_NONE;
+                client_send(client, status ? failed : rejected,
+                            (status ? sizeof(failed) : sizeof(rejected)) - 1);
+                return;
+        }
+
+        ota_upload_result_t result;
+        int status = ota_upload_finish(has_expected ? expected : NULL, &result);
+        client->ota = OTA_NONE;
+        if (status) {
+                client_send(client, has_expected ? rejected : failed,
+                            (has_expected ? sizeof(rejected) : sizeof(failed)) - 1);
+                return;
+        }
+
+        char digest[65];
+        for (int i = 0; i < 32; i++)
+                snprintf(digest + i*2, 3, "%02x", result.sha256[i]);
+
+        char body[160];
+        int body_length = snprintf(
+                body, sizeof(body),
+                "{\"size\":%u,\"sha256\":\"%s\",\"ms\":%u,\"peak_heap\":%u}\n",
+                (unsigned) result.size, digest, (unsigned) result.duration_ms,
+                (unsigned) result.peak_heap);
+
+        char header[96];
+        int header_length = snprintf(
+                header, sizeof(header),
+                "HTTP/1.1 200 \r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n",
+                body_length);
+        client_send(client, header, header_length);
+        client_send(client, body, body_length);
+
+#ifndef WIFI_CONFIG_NO_RESTART
+        const esp_timer_create_args_t restart_timer_args = {
+                .callback = wifi_config_ota_restart,
+                .name = "wifi_config OTA",
+        };
+        esp_timer_handle_t restart_timer;
+        if (esp_timer_create(&restart_timer_args, &restart_timer) == ESP_OK) {
+                esp_timer_start_once(restart_timer, WIFI_CONFIG_OTA_RESTART_DELAY * 1000);
+        }
+#endif
+}
+#endif
+
+
+static void wifi_config_server_on_asset(client_t *client) {
+        char etag[12];
+        snprintf(etag, sizeof(etag), "\"%08x\"", (unsigned) client->asset.etag);
+
+        char header[256];
+        int header_length;
+        if (client->if_none_match_length == strlen(etag) &&
+            !memcmp(client->if_none_match, etag, client->if_none_match_length)) {
+                header_length = snprintf(
+                        header, sizeof(header),
+                        "HTTP/1.1 304 \r\n"
+                        "ETag: %s\r\n"
+                        "Cache-Control: public, max-age=%d, immutable\r\n"
+                        "\r\n",
+                        etag, WIFI_CONFIG_ASSET_MAX_AGE);
+                client_send(client, header, header_length);
+                return;
+        }
+
+        header_length = snprintf(
+                header, sizeof(header),
+                "HTTP/1.1 200 \r\n"
+                "Content-Type: %.*s\r\n"
+                "Content-Length: %u\r\n"
+                "ETag: %s\r\n"
+                "Cache-Control: public, max-age=%d, immutable\r\n"
+                "\r\n",
+                (int) client->asset.content_type_length, client->asset.content_type,
+                (unsigned) client->asset.length, etag, WIFI_CONFIG_ASSET_MAX_AGE);
+        client_send(client, header, header_length);
+
+        // Sent straight from memory mapped flash, without a copy in RAM
+        client_send(client, (const char *) client->asset.data, client->asset.length);
+}
+
+
+static int wifi_config_server_on_message_begin(http_parser *parser) {
+        client_t *client = parser->data;
+
+        if (!client->in_request) {
+                client->in_request = true;
+                context->http_requests_in_flight++;
+        }
+        client->request_started = esp_timer_get_time();
+        client_set_deadline(client, WIFI_CONFIG_HTTP_HEADER_TIMEOUT);
 
         client->endpoint = ENDPOINT_UNKNOWN;
+        client->url_length = 0;
+        client->header = HEADER_OTHER;
+        client->header_match = 0;
+        client->header_value = false;
+        client->if_none_match_length = 0;
+#ifdef WIFI_CONFIG_OTA_TOKEN
+        client->authorization_length = 0;
+#endif
+
+        return 0;
+}
+
+
+static int wifi_config_server_on_url(http_parser *parser, const char *data, size_t length) {
+        client_t *client = parser->data;
+
+        // Overlong URLs are marked by a length past the buffer and never match
+        if (client->url_length + length > sizeof(client->url)) {
+                client->url_length = sizeof(client->url) + 1;
+                return 0;
+        }
+
+        memcpy(client->url + client->url_length, data, length);
+        client->url_length += length;
+
+        return 0;
+}
+
+
+static int wifi_config_server_on_header_field(http_parser *parser, const char *data, size_t length) {
+        client_t *client = parser->data;
+
+        if (client->header_value) {
+                client->header_value = false;
+                client->header = HEADER_OTHER;
+                client->header_match = 0;
+        }
+
+        for (size_t i = 0; i < length; i++) {
+                char c = tolower((unsigned char) data[i]);
+                if (!client->header_match) {
+                        for (header_t header = 0; header < HEADER_OTHER; header++) {
+                                if (http_headers[header][0] == c)
+                                        client->header = header;
+                        }
+                }
+
+                if (client->header != HEADER_OTHER && http_headers[client->header][client->header_match] == c) {
+                        client->header_match++;
+                } else {
+                        client->header = HEADER_OTHER;
+                        client->header_match = 1;
+                }
+        }
+
+        return 0;
+}
+
+
+// Overlong values are marked by a length past the buffer and never match
+static void header_value_append(char *value, size_t size, size_t *value_length,
+                                const char *data, size_t length) {
+        if (*value_length + length > size) {
+                *value_length = size + 1;
+                return;
+        }
+
+        memcpy(value + *value_length, data, length);
+        *value_length += length;
+}
+
+
+static int wifi_config_server_on_header_value(http_parser *parser, const char *data, size_t length) {
+        client_t *client = parser->data;
+
+        client->header_value = true;
+        if (client->header == HEADER_OTHER || client->header_match != strlen(http_headers[client->header]))
+                return 0;
+
+        switch (client->header) {
+        case HEADER_IF_NONE_MATCH:
+                header_value_append(client->if_none_match, sizeof(client->if_none_match),
+                                    &client->if_none_match_length, data, length);
+                break;
+        case HEADER_AUTHORIZATION:
+#ifdef WIFI_CONFIG_OTA_TOKEN
+                header_value_append(client->authorization, sizeof(client->authorization),
+                                    &client->authorization_length, data, length);
+#endif
+                break;
+        default:
+                break;
+        }
+
+        return 0;
+}
+
+
+static int wifi_config_server_on_headers_complete(http_parser *parser) {
+        client_t *client = parser->data;
+
+        client_set_deadline(client, WIFI_CONFIG_HTTP_BODY_TIMEOUT);
+
+        if (client->url_length > sizeof(client->url)) {
+                DEBUG("Got HTTP request with overlong URL");
+                return 0;
+        }
+
+        // Routing ignores the query string
+        size_t path_length = 0;
+        while (path_length < client->url_length && client->url[path_length] != '?')
+                path_length++;
+
+#define PATH_IS(path) (path_length == sizeof(path) - 1 && !memcmp(client->url, path, path_length))
         if (parser->method == HTTP_GET) {
-                if (!strncmp(data, "/settings", length)) {
+                if (PATH_IS("/settings")) {
                         client->endpoint = ENDPOINT_SETTINGS;
-                } else if (!strncmp(data, "/", length)) {
+                } else if (PATH_IS("/status")) {
+                        client->endpoint = ENDPOINT_STATUS;
+                } else if (PATH_IS("/events")) {
+                        client->endpoint = ENDPOINT_EVENTS;
+                } else if (PATH_IS("/metrics")) {
+                        client->endpoint = ENDPOINT_METRICS;
+#ifdef WIFI_CONFIG_TRACE
+                } else if (PATH_IS("/trace")) {
+                        client->endpoint = ENDPOINT_TRACE;
+#endif
+                } else if (PATH_IS("/")) {
                         client->endpoint = ENDPOINT_INDEX;
+                } else if (asset_store_find(client->url, path_length, &client->asset)) {
+                        client->endpoint = ENDPOINT_ASSET;
                 }
         } else if (parser->method == HTTP_POST) {
-                if (!strncmp(data, "/settings", length)) {
+                if (PATH_IS("/settings")) {
                         client->endpoint = ENDPOINT_SETTINGS_UPDATE;
+                } else if (PATH_IS("/provision")) {
+                        client->endpoint = ENDPOINT_PROVISION;
+#ifdef WIFI_CONFIG_OTA
+                } else if (PATH_IS("/ota")) {
+                        client->endpoint = ENDPOINT_OTA;
+#endif
                 }
         }
+#undef PATH_IS
+
+#ifdef WIFI_CONFIG_OTA
+        if (client->endpoint == ENDPOINT_OTA) {
+                size_t expected_size = parser->content_length != ULLONG_MAX ? parser->content_length : 0;
+                if (!ota_authorized(client)) {
+                        INFO("Rejecting firmware upload without a valid token");
+                        client->ota = OTA_DENIED;
+                } else {
+                        client->ota = ota_upload_begin(expected_size) ? OTA_FAILED : OTA_RECEIVING;
+                }
+        }
+#endif
 
         if (client->endpoint == ENDPOINT_UNKNOWN) {
-                char *url = strndup(data, length);
-                DEBUG("Got HTTP request: %s %s", http_method_str(parser->method), url);
-                free(url);
+                DEBUG("Got HTTP request: %s %.*s", http_method_str(parser->method),
+                      (int) client->url_length, client->url);
         }
 
         return 0;
@@ -483,6 +1653,19 @@ static int wifi_config_server_on_url(http_parser *parser, const char *data, size
 
 static int wifi_config_server_on_body(http_parser *parser, const char *data, size_t length) {
         client_t *client = parser->data;
+
+        if (client->endpoint == ENDPOINT_OTA) {
+                // An image takes longer than any form; it only has to keep coming
+                client_set_deadline(client, WIFI_CONFIG_HTTP_BODY_TIMEOUT);
+
+                // The HTTP task never reads more than the upload has room for
+                if (client->ota == OTA_RECEIVING && ota_upload_write(data, length) != length) {
+                        ota_upload_abort();
+                        client->ota = OTA_FAILED;
+                }
+                return 0;
+        }
+
         client->body = realloc(client->body, client->body_length + length + 1);
         memcpy(client->body + client->body_length, data, length);
         client->body_length += length;
@@ -495,6 +1678,8 @@ static int wifi_config_server_on_body(http_parser *parser, const char *data, siz
 static int wifi_config_server_on_message_complete(http_parser *parser) {
         client_t *client = parser->data;
 
+        TRACE_BEGIN(TRACE_HTTP_HANDLER, client->endpoint);
+
         switch(client->endpoint) {
         case ENDPOINT_INDEX: {
                 DEBUG("GET / -> redirecting to /settings");
@@ -511,63 +1696,252 @@ static int wifi_config_server_on_message_complete(http_parser *parser) {
                 wifi_config_server_on_settings_update(client);
                 break;
         }
+        case ENDPOINT_STATUS: {
+                DEBUG("GET /status");
+                wifi_config_server_on_status(client);
+                break;
+        }
+        case ENDPOINT_EVENTS: {
+                DEBUG("GET /events");
+                wifi_config_server_on_events(client);
+                break;
+        }
+        case ENDPOINT_METRICS: {
+                DEBUG("GET /metrics");
+                wifi_config_server_on_metrics(client);
+                break;
+        }
+        case ENDPOINT_PROVISION: {
+                DEBUG("POST /provision");
+                wifi_config_server_on_provision(client);
+                break;
+        }
+        case ENDPOINT_OTA: {
+#ifdef WIFI_CONFIG_OTA
+                DEBUG("POST /ota");
+                wifi_config_server_on_ota(client);
+#endif
+                break;
+        }
+        case ENDPOINT_TRACE: {
+#ifdef WIFI_CONFIG_TRACE
+                DEBUG("GET /trace");
+                wifi_config_server_on_trace(client);
+#endif
+                break;
+        }
+        case ENDPOINT_ASSET: {
+                DEBUG("GET %.*s", (int) client->url_length, client->url);
+                wifi_config_server_on_asset(client);
+                break;
+        }
         case ENDPOINT_UNKNOWN: {
-                DEBUG("Unknown endpoint -> redirecting to http://192.168.4.1/settings");
-                client_send_redirect(client, 302, "http://192.168.4.1/settings");
+                esp_ip4_addr_t ip = wifi_config_portal_ip4();
+                char url[32];
+                snprintf(url, sizeof(url), "http://" IPSTR "/settings", IP2STR(&ip));
+                DEBUG("Unknown endpoint -> redirecting to %s", url);
+                client_send_redirect(client, 302, url);
                 break;
         }
         }
 
+        TRACE_END(TRACE_HTTP_HANDLER, client->endpoint);
+
+        metrics_http_request(endpoint_metrics[client->endpoint],
+                             (esp_timer_get_time() - client->request_started) / 1000);
+
         if (client->body) {
                 free(client->body);
                 client->body = NULL;
                 client->body_length = 0;
         }
 
+        client->ota = OTA_NONE;
+        client_request_done(client);
+        client_set_deadline(client, WIFI_CONFIG_HTTP_IDLE_TIMEOUT);
+
         return 0;
 }
 
 
 static http_parser_settings wifi_config_http_parser_settings = {
+        .on_message_begin = wifi_config_server_on_message_begin,
         .on_url = wifi_config_server_on_url,
+        .on_header_field = wifi_config_server_on_header_field,
+        .on_header_value = wifi_config_server_on_header_value,
+        .on_headers_complete = wifi_config_server_on_headers_complete,
         .on_body = wifi_config_server_on_body,
         .on_message_complete = wifi_config_server_on_message_complete,
 };
 
 
-static void http_task(void *arg) {
-        INFO("Starting HTTP server");
+static int portal_event_format(const portal_event_t *event, char *buffer, size_t size) {
+        switch (event->type) {
+        case PORTAL_EVENT_ASSOCIATING:
+                return snprintf(buffer, size, "event: associating\ndata: {}\n\n");
+        case PORTAL_EVENT_CONNECTED: {
+                const uint8_t *ip = (const uint8_t *) &event->value;
+                return snprintf(buffer, size, "event: connected\ndata: {\"ip\":\"%d.%d.%d.%d\"}\n\n",
+                                ip[0], ip[1], ip[2], ip[3]);
+        }
+        case PORTAL_EVENT_DISCONNECTED:
+                return snprintf(buffer, size, "event: disconnected\ndata: {\"reason\":%u}\n\n",
+                                (unsigned) event->value);
+        case PORTAL_EVENT_FAILED:
+                return snprintf(buffer, size, "event: failed\ndata: {\"reason\":%u}\n\n",
+                                (unsigned) event->value);
+        case PORTAL_EVENT_SCAN_UPDATED:
+                return snprintf(buffer, size, "event: scan\ndata: {\"networks\":%u}\n\n",
+                                (unsigned) event->value);
+        default:
+                return 0;
+        }
+}
+
+
+static void event_stream_close(event_stream_t *stream, fd_set *fds) {
+        DEBUG("Event stream %d closed", stream->fd);
+        FD_CLR(stream->fd, fds);
+        lwip_close(stream->fd);
+        free(stream);
+}
+
+
+// Pushes queued portal events to every stream. A stream whose socket can't
+// take the whole event without blocking is dropped; the browser reconnects.
+// Without streams the events are discarded, so the queue never fills up
+// with stale events that would be replayed to the next stream.
+static void event_streams_publish(event_stream_t **streams, int *stream_count, fd_set *fds) {
+        portal_event_t event;
+        while (xQueueReceive(context->portal_event_queue, &event, 0) == pdTRUE) {
+                if (!*streams)
+                        continue;
+
+                char buffer[80];
+                int length = portal_event_format(&event, buffer, sizeof(buffer));
+                if (length <= 0)
+                        continue;
+
+                event_stream_t **sp = streams;
+                while (*sp) {
+                        event_stream_t *stream = *sp;
+                        if (lwip_send(stream->fd, buffer, length, MSG_DONTWAIT) != length) {
+                                *sp = stream->next;
+                                event_stream_close(stream, fds);
+                                (*stream_count)--;
+                        } else {
+                                metrics_add(METRIC_HTTP_BYTES_SENT, length);
+                                sp = &stream->next;
+                        }
+                }
+        }
+}
+
+
+// Binds a socket of the given family to the wildcard address and port.
+// IPv6 sockets are v6 only, IPv4 is served by its own socket.
+static int portal_socket(int family, int type, uint16_t port) {
+        int fd = socket(family, type, 0);
+        if (fd < 0)
+                return -1;
+
+        int result;
+#if LWIP_IPV6
+        if (family == AF_INET6) {
+                const int yes = 1;
+                setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes));
+
+                struct sockaddr_in6 serv_addr;
+                memset(&serv_addr, 0, sizeof(serv_addr));
+                serv_addr.sin6_family = AF_INET6;
+                serv_addr.sin6_addr = in6addr_any;
+                serv_addr.sin6_port = htons(port);
+                result = bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        } else
+#endif
+        {
+                struct sockaddr_in serv_addr;
+                memset(&serv_addr, 0, sizeof(serv_addr));
+                serv_addr.sin_family = AF_INET;
+                serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                serv_addr.sin_port = htons(port);
+                result = bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+        }
+
+        if (result < 0) {
+                lwip_close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+
+static int http_listen(int family) {
+        int listenfd = portal_socket(family, SOCK_STREAM, WIFI_CONFIG_SERVER_PORT);
+        if (listenfd < 0)
+                return -1;
 
-        struct sockaddr_in serv_addr;
-        int listenfd = socket(AF_INET, SOCK_STREAM, 0);
-        memset(&serv_addr, '0', sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        serv_addr.sin_port = htons(WIFI_CONFIG_SERVER_PORT);
         int flags;
-        if ((flags = lwip_fcntl(listenfd, F_GETFL, 0)) < 0) {
-                ERROR("Failed to get HTTP socket flags");
-                lwip_close(listenfd);
-                vTaskDelete(NULL);
-                return;
-        };
-        if (lwip_fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        if ((flags = lwip_fcntl(listenfd, F_GETFL, 0)) < 0 ||
+            lwip_fcntl(listenfd, F_SETFL, flags | O_NONBLOCK) < 0) {
                 ERROR("Failed to set HTTP socket flags");
                 lwip_close(listenfd);
-                vTaskDelete(NULL);
-                return;
+                return -1;
         }
-        bind(listenfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
         listen(listenfd, 2);
 
+        return listenfd;
+}
+
+
+static void http_task(void *arg) {
+        INFO("Starting HTTP server");
+
+        // An IPv4 and, when lwIP has IPv6, an IPv6 listener
+        int listenfds[2] = { http_listen(AF_INET), -1 };
+#if LWIP_IPV6
+        listenfds[1] = http_listen(AF_INET6);
+#endif
+        if (listenfds[0] < 0 && listenfds[1] < 0) {
+                ERROR("Failed to create HTTP socket");
+                portal_task_exit(PORTAL_HTTP_STOPPED);
+                return;
+        }
+
+        if (asset_store_open(WIFI_CONFIG_ASSET_PARTITION)) {
+                DEBUG("No asset partition %s, serving built-in pages only", WIFI_CONFIG_ASSET_PARTITION);
+        }
+
         client_t *clients = NULL;
+        event_stream_t *streams = NULL;
+        int stream_count = 0;
+
+        timer_wheel_t timers;
+        timer_wheel_init(&timers, http_timer_now());
+        context->http_timers = &timers;
+
+        char send_buffer[WIFI_CONFIG_SEND_BUFFER_SIZE];
+
+        // Drop events from before this portal session
+        xQueueReset(context->portal_event_queue);
 
         fd_set fds;
-        int max_fd = listenfd;
+        int listen_max_fd = -1;
 
-        FD_SET(listenfd, &fds);
+        FD_ZERO(&fds);
+        for (int i = 0; i < 2; i++) {
+                if (listenfds[i] < 0)
+                        continue;
+                FD_SET(listenfds[i], &fds);
+                if (listenfds[i] > listen_max_fd)
+                        listen_max_fd = listenfds[i];
+        }
+        int max_fd = listen_max_fd;
 
         char data[64];
+#ifdef WIFI_CONFIG_OTA
+        char upload_data[WIFI_CONFIG_OTA_READ_SIZE];
+#endif
 
         bool running = true;
         while (running) {
@@ -579,372 +1953,1489 @@ static void http_task(void *arg) {
                         }
                 }
 
+                event_streams_publish(&streams, &stream_count, &fds);
+
                 fd_set read_fds;
                 memcpy(&read_fds, &fds, sizeof(read_fds));
 
-                struct timeval timeout = { 1, 0 }; // 1 second timeout
+                // Poll more often while streams are waiting for events, and
+                // wake up in time for the next client deadline
+                uint32_t timeout_ms = timer_wheel_next(&timers, (streams ? 200 : 1000) / HTTP_TIMER_TICK) *
+                                      HTTP_TIMER_TICK;
+                // and in time to see a stop request
+                if (timeout_ms > WIFI_CONFIG_PORTAL_STOP_LATENCY)
+                        timeout_ms = WIFI_CONFIG_PORTAL_STOP_LATENCY;
+
+#ifdef WIFI_CONFIG_OTA
+                // Back-pressure: while both upload buffers wait for flash the
+                // uploader's socket is left unread, so its TCP window fills
+                // and the sender stalls. Check back soon for free space.
+                if (!ota_upload_space()) {
+                        for (client_t *c = clients; c; c = c->next) {
+                                if (c->ota == OTA_RECEIVING) {
+                                        FD_CLR(c->fd, &read_fds);
+                                        timeout_ms = 10;
+                                }
+                        }
+                }
+#endif
+
+                struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
                 int triggered_nfds = lwip_select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
 
-                if (triggered_nfds <= 0)
-                        continue;
+                // Clients that missed a deadline are dropped with the
+                // disconnected ones below
+                timer_wheel_entry_t *expired;
+                while ((expired = timer_wheel_expire(&timers, http_timer_now()))) {
+                        client_t *client = (client_t *) ((char *) expired - offsetof(client_t, deadline));
+                        DEBUG("Client %d timed out", client->fd);
+                        metrics_add(METRIC_HTTP_TIMEOUTS, 1);
+                        client->disconnected = true;
+                }
+
+                if (triggered_nfds < 0)
+                        triggered_nfds = 0;
+
+                for (int i = 0; i < 2; i++) {
+                        int listenfd = listenfds[i];
+                        if (listenfd < 0 || !FD_ISSET(listenfd, &read_fds))
+                                continue;
 
-                if (FD_ISSET(listenfd, &read_fds)) {
                         int fd = accept(listenfd, (struct sockaddr *)NULL, (socklen_t *)NULL);
+                        TRACE_INSTANT(TRACE_HTTP_ACCEPT, fd);
                         if (fd > 0) {
-                                const struct timeval timeout = { 2, 0 }; /* 2 second timeout */
-                                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-
                                 const int yes = 1; /* enable sending keepalive probes for socket */
                                 setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes));
 
-                                const int interval = 5; /* 30 sec between probes */
-                                setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+                                const int interval = 5; /* 30 sec between probes */
+                                setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+
+                                const int maxpkt = 4; /* Drop connection after 4 probes without response */
+                                setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &maxpkt, sizeof(maxpkt));
+
+                                client_t *client = client_new();
+                                client->fd = fd;
+                                client->output.buffer = send_buffer;
+                                client->output.size = sizeof(send_buffer);
+                                client->output.flush = client_output_flush;
+                                client->output.arg = client;
+                                client->next = clients;
+
+                                clients = client;
+
+                                // A connection that never sends a request
+                                // is held to the header deadline too
+                                client_set_deadline(client, WIFI_CONFIG_HTTP_HEADER_TIMEOUT);
+
+                                FD_SET(fd, &fds);
+                                if (fd > max_fd)
+                                        max_fd = fd;
+                        }
+
+                        triggered_nfds--;
+                }
+
+                client_t *c = clients;
+                while (c && triggered_nfds) {
+                        if (FD_ISSET(c->fd, &read_fds)) {
+                                triggered_nfds--;
+
+                                char *buffer = data;
+                                size_t buffer_size = sizeof(data);
+#ifdef WIFI_CONFIG_OTA
+                                if (c->endpoint == ENDPOINT_OTA) {
+                                        buffer = upload_data;
+                                        buffer_size = sizeof(upload_data);
+                                        if (c->ota == OTA_RECEIVING && ota_upload_space() < buffer_size)
+                                                buffer_size = ota_upload_space();
+                                }
+#endif
+
+                                TRACE_BEGIN(TRACE_HTTP_READ, c->fd);
+                                int data_len = lwip_read(c->fd, buffer, buffer_size);
+                                TRACE_END(TRACE_HTTP_READ, data_len);
+                                if (data_len <= 0) {
+                                        DEBUG("Client %d disconnected", c->fd);
+                                        c->disconnected = true;
+                                } else {
+                                        DEBUG("Client %d got %d incomming data", c->fd, data_len);
+                                        TRACE_BEGIN(TRACE_HTTP_PARSE, data_len);
+                                        http_parser_execute(
+                                                &c->parser, &wifi_config_http_parser_settings,
+                                                buffer, data_len
+                                                );
+                                        TRACE_END(TRACE_HTTP_PARSE, c->fd);
+                                }
+                        }
+
+                        c = c->next;
+                }
+
+                // Streams only send; readable means the peer closed or sent junk
+                event_stream_t **sp = &streams;
+                while (*sp && triggered_nfds) {
+                        event_stream_t *stream = *sp;
+                        if (FD_ISSET(stream->fd, &read_fds)) {
+                                triggered_nfds--;
+
+                                if (lwip_read(stream->fd, data, sizeof(data)) <= 0) {
+                                        *sp = stream->next;
+                                        event_stream_close(stream, &fds);
+                                        stream_count--;
+                                        continue;
+                                }
+                        }
+
+                        sp = &stream->next;
+                }
+
+                client_t **cp = &clients;
+                while (*cp) {
+                        c = *cp;
+                        if (c->event_stream && !c->disconnected) {
+                                if (stream_count >= WIFI_CONFIG_MAX_EVENT_STREAMS) {
+                                        DEBUG("Too many event streams, dropping client %d", c->fd);
+                                        c->disconnected = true;
+                                } else {
+                                        event_stream_t *stream = malloc(sizeof(event_stream_t));
+                                        if (stream) {
+                                                stream->fd = c->fd;
+                                                stream->next = streams;
+                                                streams = stream;
+                                                stream_count++;
+
+                                                // The socket now belongs to the stream
+                                                c->fd = -1;
+                                        }
+                                        c->disconnected = true;
+                                }
+                        }
+
+                        if (c->disconnected) {
+                                *cp = c->next;
+
+                                if (c->fd >= 0) {
+                                        FD_CLR(c->fd, &fds);
+                                        lwip_close(c->fd);
+                                }
+                                client_free(c);
+                        } else {
+                                cp = &c->next;
+                        }
+                }
+
+                max_fd = listen_max_fd;
+                for (c = clients; c; c = c->next) {
+                        if (c->fd > max_fd)
+                                max_fd = c->fd;
+                }
+                for (event_stream_t *stream = streams; stream; stream = stream->next) {
+                        if (stream->fd > max_fd)
+                                max_fd = stream->fd;
+                }
+        }
+
+        INFO("Stopping HTTP server");
+
+        while (clients) {
+                client_t *c = clients;
+                clients = c->next;
+
+                lwip_close(c->fd);
+                client_free(c);
+        }
+        context->http_timers = NULL;
+
+        while (streams) {
+                event_stream_t *stream = streams;
+                streams = stream->next;
+
+                event_stream_close(stream, &fds);
+        }
+
+        for (int i = 0; i < 2; i++) {
+                if (listenfds[i] >= 0)
+                        lwip_close(listenfds[i]);
+        }
+        asset_store_close();
+        portal_task_exit(PORTAL_HTTP_STOPPED);
+}
+
+
+static void http_start() {
+        if (xTaskCreate(http_task, "wifi_config HTTP", 8192, NULL, 2, &context->http_task_handle) != pdPASS) {
+                ERROR("Failed to create HTTP task");
+                context->http_task_handle = NULL;
+                xEventGroupSetBits(context->portal_events, PORTAL_HTTP_STOPPED);
+        }
+}
+
+
+static void http_stop() {
+        if (!context->http_task_handle)
+                return;
+
+        xTaskNotify(context->http_task_handle, 1, eSetValueWithOverwrite);
+}
+
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+
+// Answers every query for an A or AAAA record with the portal's own
+// address. Other types, and AAAA while the AP has no v6 address yet, get
+// an empty answer so clients move on immediately instead of timing out.
+// Returns the reply length, or 0 to drop the query.
+static size_t dns_reply(uint8_t *buffer, size_t count, size_t size) {
+        if (count < 12)
+                return 0;
+
+        size_t qname_len = strnlen((char *) buffer + 12, count - 12) + 1;
+        size_t question_end = 12 + qname_len + 4;
+        // Room for the largest answer (AAAA)
+        if (question_end > count || question_end + 12 + 16 > size)
+                return 0;
+
+        uint16_t qtype = (buffer[12 + qname_len] << 8) | buffer[12 + qname_len + 1];
+
+        uint8_t address[16];
+        size_t address_len = 0;
+        if (qtype == DNS_TYPE_A) {
+                esp_ip4_addr_t ip = wifi_config_portal_ip4();
+                memcpy(address, &ip.addr, 4);
+                address_len = 4;
+        }
+#if LWIP_IPV6
+        else if (qtype == DNS_TYPE_AAAA) {
+                esp_ip6_addr_t ip6;
+                if (wifi_config_portal_ip6(&ip6)) {
+                        memcpy(address, ip6.addr, 16);
+                        address_len = 16;
+                }
+        }
+#endif
+
+        uint8_t *head = buffer + 2;
+        *head++ = 0x80; // Flags
+        *head++ = 0x00;
+        *head++ = 0x00; // Q count
+        *head++ = 0x01;
+        *head++ = 0x00; // A count
+        *head++ = address_len ? 0x01 : 0x00;
+        *head++ = 0x00; // Auth count
+        *head++ = 0x00;
+        *head++ = 0x00; // Add count
+        *head++ = 0x00;
+        head = buffer + question_end;
+        if (!address_len)
+                return question_end;
+
+        *head++ = 0xC0; // LBL offs
+        *head++ = 0x0C;
+        *head++ = qtype >> 8; // Type
+        *head++ = qtype & 0xff;
+        *head++ = 0x00; // Class
+        *head++ = 0x01;
+        *head++ = 0x00; // TTL
+        *head++ = 0x00;
+        *head++ = 0x00;
+        *head++ = 0x78;
+        *head++ = 0x00; // RD len
+        *head++ = address_len;
+        memcpy(head, address, address_len);
+        head += address_len;
+
+        return head - buffer;
+}
+
+
+static void dns_task(void *arg)
+{
+        INFO("Starting DNS server");
+
+        int fds[2] = { portal_socket(AF_INET, SOCK_DGRAM, 53), -1 };
+#if LWIP_IPV6
+        fds[1] = portal_socket(AF_INET6, SOCK_DGRAM, 53);
+#endif
+
+        const struct ifreq ifreq1 = { "en1" };
+        int max_fd = -1;
+        for (int i = 0; i < 2; i++) {
+                if (fds[i] < 0)
+                        continue;
+                setsockopt(fds[i], SOL_SOCKET, SO_BINDTODEVICE, &ifreq1, sizeof(ifreq1));
+                if (fds[i] > max_fd)
+                        max_fd = fds[i];
+        }
+
+        for (;;) {
+                fd_set read_fds;
+                FD_ZERO(&read_fds);
+                for (int i = 0; i < 2; i++) {
+                        if (fds[i] >= 0)
+                                FD_SET(fds[i], &read_fds);
+                }
+
+                // Short, so a stop request is seen right away
+                struct timeval timeout = { 0, WIFI_CONFIG_PORTAL_STOP_LATENCY * 1000 };
+                int triggered_nfds = max_fd >= 0 ? lwip_select(max_fd + 1, &read_fds, NULL, NULL, &timeout) : 0;
+                if (max_fd < 0)
+                        vTaskDelay(pdMS_TO_TICKS(WIFI_CONFIG_PORTAL_STOP_LATENCY));
+
+                for (int i = 0; i < 2 && triggered_nfds > 0; i++) {
+                        if (fds[i] < 0 || !FD_ISSET(fds[i], &read_fds))
+                                continue;
+
+                        uint8_t buffer[128];
+                        struct sockaddr_storage src_addr;
+                        socklen_t src_addr_len = sizeof(src_addr);
+                        int count = recvfrom(fds[i], buffer, sizeof(buffer), 0, (struct sockaddr*)&src_addr, &src_addr_len);
+                        TRACE_INSTANT(TRACE_DNS_RECEIVE, count);
+
+                        /* Drop messages that are too large to send a response in the buffer */
+                        size_t reply_len = count > 0 ? dns_reply(buffer, count, sizeof(buffer)) : 0;
+                        if (reply_len) {
+                                DEBUG("Got DNS query, sending response");
+                                TRACE_INSTANT(TRACE_DNS_REPLY, reply_len);
+                                if (sendto(fds[i], buffer, reply_len, 0, (struct sockaddr*)&src_addr, src_addr_len) > 0)
+                                        metrics_add(METRIC_DNS_QUERIES_ANSWERED, 1);
+                        }
+                }
+
+                uint32_t task_value = 0;
+                if (xTaskNotifyWait(0, 1, &task_value, 0) == pdTRUE) {
+                        if (task_value)
+                                break;
+                }
+        }
+
+        INFO("Stopping DNS server");
+
+        for (int i = 0; i < 2; i++) {
+                if (fds[i] >= 0)
+                        lwip_close(fds[i]);
+        }
+
+        portal_task_exit(PORTAL_DNS_STOPPED);
+}
+
+
+static void dns_start() {
+        if (xTaskCreate(dns_task, "wifi_config DNS", 4096, NULL, 2, &context->dns_task_handle) != pdPASS) {
+                ERROR("Failed to create DNS task");
+                context->dns_task_handle = NULL;
+                xEventGroupSetBits(context->portal_events, PORTAL_DNS_STOPPED);
+        }
+}
+
+
+static void dns_stop() {
+        if (!context->dns_task_handle)
+                return;
+
+        xTaskNotify(context->dns_task_handle, 1, eSetValueWithOverwrite);
+}
+
+
+static void scan_start() {
+        // A recent enough list, e.g. from the pre-scan, needs no immediate rescan
+        bool fresh = wifi_networks_updated &&
+                     esp_timer_get_time() - wifi_networks_updated < WIFI_CONFIG_SCAN_INTERVAL * 1000LL;
+
+        if (xTaskCreate(wifi_scan_task, "wifi_config scan", 4096, fresh ? (void *) 1 : NULL, 2,
+                        &context->scan_task_handle) != pdPASS) {
+                ERROR("Failed to create scan task");
+                context->scan_task_handle = NULL;
+                xEventGroupSetBits(context->portal_events, PORTAL_SCAN_STOPPED);
+        }
+}
+
+
+static void scan_stop() {
+        if (!context->scan_task_handle)
+                return;
+
+        xTaskNotify(context->scan_task_handle, 1, eSetValueWithOverwrite);
+        // A blocking sweep takes seconds, the task returns from it right away
+        if (context->portal_scan_running)
+                esp_wifi_scan_stop();
+}
+
+
+static int portal_station_count() {
+        wifi_sta_list_t stations;
+        if (esp_wifi_ap_get_sta_list(&stations) != ESP_OK)
+                return 0;
+        return stations.num;
+}
+
+
+static void portal_services_start() {
+        if (context->portal_services_running)
+                return;
+
+        INFO("Starting portal services");
+
+        xEventGroupClearBits(context->portal_events, PORTAL_ALL_STOPPED);
+        context->portal_services_running = true;
+
+        scan_start();
+        dns_start();
+        http_start();
+}
+
+
+// The SoftAP shares the radio with the station, so an AP on another channel
+// than the network being joined hops away on every connect attempt and
+// stalls portal traffic. Prefer the channel of the saved network, then the
+// least congested one. Returns 0 to keep the driver's choice. Once the
+// station associates, the driver moves the AP to its channel by itself.
+static uint8_t wifi_config_ap_channel() {
+        uint8_t channel = 0;
+
+        char *wifi_ssid = NULL;
+        sysparam_get_string("wifi_ssid", &wifi_ssid);
+
+        xSemaphoreTake(wifi_networks_mutex, portMAX_DELAY);
+        wifi_network_info_t *net = wifi_ssid ? wifi_networks_find(wifi_ssid) : NULL;
+        if (net && net->channel) {
+                DEBUG("Saved network %s is on channel %d", net->ssid, net->channel);
+                channel = net->channel;
+        } else {
+                channel = wifi_networks_quiet_channel;
+        }
+        xSemaphoreGive(wifi_networks_mutex);
+
+        free(wifi_ssid);
+        return channel;
+}
+
+
+static void wifi_config_softap_up();
+
+
+static void wifi_config_softap_start() {
+        if (context->portal_events) {
+                DEBUG("Portal is already running");
+                return;
+        }
+
+        INFO("Starting AP mode");
+
+        context->portal_events = xEventGroupCreate();
+        wifi_networks_mutex = xSemaphoreCreateMutex();
+        if (!context->portal_events || !wifi_networks_mutex) {
+                ERROR("Failed to allocate portal resources");
+                if (context->portal_events) {
+                        vEventGroupDelete(context->portal_events);
+                        context->portal_events = NULL;
+                }
+                if (wifi_networks_mutex) {
+                        vSemaphoreDelete(wifi_networks_mutex);
+                        wifi_networks_mutex = NULL;
+                }
+                return;
+        }
+
+        xSemaphoreTake(wifi_networks_mutex, portMAX_DELAY);
+        scan_cache_load();
+        xSemaphoreGive(wifi_networks_mutex);
+
+        if (!wifi_config_prescan_start())
+                wifi_config_softap_up();
+}
+
+
+// Runs on the timer service task, like wifi_config_softap_start() and
+// wifi_config_softap_stop(), so the portal can't go away halfway through
+static void wifi_config_prescan_done(void *arg, uint32_t unused) {
+        if (!context || !context->prescan_pending)
+                return;
+        context->prescan_pending = false;
+
+        uint16_t ap_num = 0;
+        esp_wifi_scan_get_ap_num(&ap_num);
+        TRACE_END(TRACE_SCAN, ap_num);
+        xSemaphoreGive(context->radio_lock);
+
+        if (!context->portal_events) {
+                DEBUG("Portal stopped during the pre-scan");
+                esp_wifi_clear_ap_list();
+                return;
+        }
+
+        uint32_t duration = (esp_timer_get_time() - context->prescan_started) / 1000;
+        metrics_scan_done(duration, ap_num);
+        if (!wifi_networks_update_from_scan(ap_num))
+                INFO("Pre-scan found %d access points in %u ms", ap_num, (unsigned) duration);
+
+        wifi_config_softap_up();
+}
+
+
+static void wifi_config_prescan_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data) {
+        if (!context || !context->prescan_pending)
+                return;
+
+        // The AP only comes up once this runs, so it must not be dropped
+        if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE)
+                xTimerPendFunctionCall(wifi_config_prescan_done, NULL, 0, portMAX_DELAY);
+}
+
+
+static void wifi_config_softap_up() {
+        sdk_wifi_set_opmode(STATIONAP_MODE);
+
+        uint8_t macaddr[6];
+        sdk_wifi_get_macaddr(SOFTAP_IF, macaddr);
+
+        wifi_config_t ap_cfg;
+        sdk_wifi_softap_get_config(&ap_cfg);
+        ap_cfg.ap.ssid_len = snprintf(
+                (char *)ap_cfg.ap.ssid, sizeof(ap_cfg.ap.ssid),
+                "%s-%02X%02X%02X", context->ssid_prefix, macaddr[3], macaddr[4], macaddr[5]
+                );
+        ap_cfg.ap.ssid_hidden = 0;
+        if (context->password) {
+                ap_cfg.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
+                strncpy((char *)ap_cfg.ap.password,
+                        context->password, sizeof(ap_cfg.ap.password));
+        } else {
+                ap_cfg.ap.authmode = WIFI_AUTH_OPEN;
+        }
+        ap_cfg.ap.max_connection = 2;
+        ap_cfg.ap.beacon_interval = 100;
+
+        uint8_t channel = wifi_config_ap_channel();
+        if (channel)
+                ap_cfg.ap.channel = channel;
+
+        DEBUG("Starting AP SSID=%s on channel %d", ap_cfg.ap.ssid, ap_cfg.ap.channel);
+
+        sdk_wifi_softap_set_config(&ap_cfg);
+
+        INFO("AP up, portal services start when a station joins");
+
+        // Stations may already be associated when the AP restarts
+        if (portal_station_count())
+                portal_services_start();
+}
+
+
+static void portal_task_delete(TaskHandle_t *task_handle) {
+        if (*task_handle) {
+                vTaskDelete(*task_handle);
+                *task_handle = NULL;
+        }
+}
+
+
+static void portal_services_stop() {
+        if (!context->portal_services_running)
+                return;
+
+        scan_stop();
+        dns_stop();
+        http_stop();
+
+        // The tasks look for the request every WIFI_CONFIG_PORTAL_STOP_LATENCY
+        // ms, so this is short; the timeout only guards against a stuck task
+        EventBits_t stopped = xEventGroupWaitBits(
+                context->portal_events, PORTAL_ALL_STOPPED, pdFALSE, pdTRUE,
+                pdMS_TO_TICKS(WIFI_CONFIG_PORTAL_STOP_TIMEOUT));
+        if ((stopped & PORTAL_ALL_STOPPED) != PORTAL_ALL_STOPPED) {
+                ERROR("Portal tasks did not stop in time (0x%x), deleting them anyway",
+                      (unsigned) stopped);
+        }
+
+        portal_task_delete(&context->scan_task_handle);
+        portal_task_delete(&context->dns_task_handle);
+        portal_task_delete(&context->http_task_handle);
+
+        context->portal_services_running = false;
+}
+
+
+// Runs on the timer service task, like the monitor that starts and stops
+// the portal, so portal state changes are serialized
+static void portal_on_station_change(void *arg, uint32_t joined) {
+        if (!context || !context->portal_events)
+                return;
+
+        if (joined) {
+                xTimerStop(context->portal_park_timer, 0);
+                portal_services_start();
+        } else if (!portal_station_count()) {
+                DEBUG("Last station left the AP");
+                xTimerReset(context->portal_park_timer, 0);
+        }
+}
+
+
+static void portal_park_timer_callback(TimerHandle_t timer) {
+        if (!context->portal_events || !context->portal_services_running || portal_station_count())
+                return;
+
+        size_t free_heap_before = esp_get_free_heap_size();
+        portal_services_stop();
+        INFO("Portal services parked, %d bytes returned to heap",
+             (int) esp_get_free_heap_size() - (int) free_heap_before);
+}
+
+
+static void wifi_config_softap_stop() {
+        if (!context->portal_events) {
+                sdk_wifi_set_opmode(STATION_MODE);
+                return;
+        }
+
+        size_t free_heap_before = esp_get_free_heap_size();
+
+        if (context->portal_park_timer)
+                xTimerStop(context->portal_park_timer, 0);
+        portal_services_stop();
+
+        wifi_networks_free();
+        wifi_networks_quiet_channel = 0;
+        wifi_networks_updated = 0;
+        vSemaphoreDelete(wifi_networks_mutex);
+        wifi_networks_mutex = NULL;
+
+        vEventGroupDelete(context->portal_events);
+        context->portal_events = NULL;
+
+        sdk_wifi_set_opmode(STATION_MODE);
+
+        INFO("Portal stopped, %d bytes returned to heap",
+             (int) esp_get_free_heap_size() - (int) free_heap_before);
+}
+
+
+typedef struct {
+        wifi_config_listener_t listener;
+        void *arg;
+} listener_entry_t;
+
+static listener_entry_t listeners[WIFI_CONFIG_MAX_LISTENERS];
+static portMUX_TYPE listeners_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+int wifi_config_subscribe(wifi_config_listener_t listener, void *arg) {
+        int result = -1;
+
+        taskENTER_CRITICAL(&listeners_lock);
+        for (int i = 0; i < WIFI_CONFIG_MAX_LISTENERS; i++) {
+                if (!listeners[i].listener) {
+                        listeners[i].listener = listener;
+                        listeners[i].arg = arg;
+                        result = 0;
+                        break;
+                }
+        }
+        taskEXIT_CRITICAL(&listeners_lock);
+
+        if (result)
+                ERROR("Too many listeners, raise WIFI_CONFIG_MAX_LISTENERS");
+        return result;
+}
+
+
+void wifi_config_unsubscribe(wifi_config_listener_t listener, void *arg) {
+        taskENTER_CRITICAL(&listeners_lock);
+        for (int i = 0; i < WIFI_CONFIG_MAX_LISTENERS; i++) {
+                if (listeners[i].listener == listener && listeners[i].arg == arg) {
+                        listeners[i].listener = NULL;
+                        listeners[i].arg = NULL;
+                }
+        }
+        taskEXIT_CRITICAL(&listeners_lock);
+}
+
+
+// A message with done set asks the event task to stop and give done
+typedef struct {
+        wifi_config_event_info_t info;
+        SemaphoreHandle_t done;
+} event_message_t;
+
+
+static void wifi_config_event_emit(const wifi_config_event_info_t *info) {
+        if (!context || !context->event_queue)
+                return;
+
+        event_message_t message = { .info = *info };
+        if (xQueueSend(context->event_queue, &message, 0) != pdTRUE)
+                ERROR("Event queue full, dropping event %d", info->event);
+}
+
+
+static void wifi_config_event_task(void *arg) {
+        event_message_t message;
+        while (xQueueReceive(context->event_queue, &message, portMAX_DELAY) == pdTRUE) {
+                if (message.done)
+                        break;
+
+                const wifi_config_event_info_t *info = &message.info;
+
+                // The original callback only knows about the link events
+                if (context->on_event &&
+                    (info->event == WIFI_CONFIG_CONNECTED || info->event == WIFI_CONFIG_DISCONNECTED))
+                        context->on_event(info->event);
+
+                // Listeners are called outside the lock, so they may unsubscribe
+                listener_entry_t snapshot[WIFI_CONFIG_MAX_LISTENERS];
+                taskENTER_CRITICAL(&listeners_lock);
+                memcpy(snapshot, listeners, sizeof(snapshot));
+                taskEXIT_CRITICAL(&listeners_lock);
+
+                for (int i = 0; i < WIFI_CONFIG_MAX_LISTENERS; i++) {
+                        if (snapshot[i].listener)
+                                snapshot[i].listener(info, snapshot[i].arg);
+                }
+        }
+
+        xSemaphoreGive(message.done);
+        vTaskSuspend(NULL);
+}
+
+
+static void wifi_config_event_task_stop() {
+        if (!context->event_task_handle)
+                return;
+
+        // Queued events are still delivered before the task stops
+        event_message_t message = { .done = xSemaphoreCreateBinary() };
+        if (message.done && xQueueSend(context->event_queue, &message, portMAX_DELAY) == pdTRUE)
+                xSemaphoreTake(message.done, portMAX_DELAY);
+        if (message.done)
+                vSemaphoreDelete(message.done);
+
+        vTaskDelete(context->event_task_handle);
+        context->event_task_handle = NULL;
+}
+
+
+// Hides a portal opened on request from the provisioning logic, which
+// would otherwise take it down as soon as it sees the connection. Returns
+// whether the monitor should see the portal as up.
+static bool wifi_config_portal_open_hold(bool got_ip) {
+        bool portal_up = sdk_wifi_get_opmode() != STATION_MODE;
+        if (!context->portal_open_until)
+                return portal_up;
+
+        trial_state_t trial_state = context->trial_state;
+        if (trial_state == TRIAL_CONNECTED) {
+                // Moved to another network, closed and reported as usual
+                context->portal_open_until = 0;
+                return portal_up;
+        }
+
+        if (trial_state == TRIAL_CONNECTING || esp_timer_get_time() < context->portal_open_until) {
+                // Without an IP it is the usual portal waiting for reconnects
+                return got_ip ? false : portal_up;
+        }
+
+        INFO("Closing the portal opened on request");
+        context->portal_open_until = 0;
+        wifi_config_softap_stop();
+        return false;
+}
+
+
+static void wifi_config_monitor_callback(TimerHandle_t xTimer) {
+        bool got_ip = sdk_wifi_station_get_connect_status() == STATION_GOT_IP;
+        provision_inputs_t inputs = {
+                .got_ip = got_ip,
+                .portal_up = wifi_config_portal_open_hold(got_ip),
+                .has_config = !got_ip && wifi_config_has_configuration(),
+                .now = esp_timer_get_time() / 1000,
+        };
+        uint32_t actions = provision_monitor(&context->provision, &provision_config, &inputs);
+
+        if (actions & (PROVISION_CONNECTED | PROVISION_RESUMED)) {
+                // Connected to station, all is dandy
+                if (actions & PROVISION_CONNECTED) {
+                        INFO("Connected to WiFi network");
+                } else {
+                        INFO("Reconnected to WiFi network within the grace period");
+                }
+
+                esp_timer_stop(context->connect_timer);
+                wifi_config_roaming_start();
+                wifi_config_liveness_start();
+        }
+
+        if (actions & PROVISION_ROAMING_STOP) {
+                wifi_config_roaming_stop();
+                wifi_config_liveness_stop();
+        }
+
+        if (actions & PROVISION_SCHEDULE_CONNECT)
+                wifi_config_connect_schedule();
+
+        if (actions & PROVISION_SOFTAP_STOP) {
+                wifi_config_softap_stop();
+                sdk_wifi_station_set_auto_connect(false);
+        }
+
+        if (actions & PROVISION_CONNECTED) {
+                wifi_config_event_info_t info = {
+                        .event = WIFI_CONFIG_CONNECTED,
+                        .connected = {
+                                .ip = sta_ip_info.ip.addr,
+                                .netmask = sta_ip_info.netmask.addr,
+                                .gateway = sta_ip_info.gw.addr,
+                        },
+                };
+                wifi_config_event_emit(&info);
+        }
+
+        if (actions & PROVISION_SOFTAP_START)
+                INFO("Disconnected from WiFi network");
+
+        if (actions & PROVISION_DISCONNECTED) {
+                wifi_config_event_info_t info = {
+                        .event = WIFI_CONFIG_DISCONNECTED,
+                        .disconnected.reason = sta_disconnect_reason,
+                };
+                wifi_config_event_emit(&info);
+        }
+
+        // change monitoring poll interval
+        if (actions & PROVISION_SET_INTERVAL) {
+                xTimerChangePeriod(
+                        context->network_monitor_timer,
+                        pdMS_TO_TICKS(context->provision.monitor_interval), 0);
+        }
+
+        if (actions & PROVISION_SOFTAP_START)
+                wifi_config_softap_start();
+}
+
+
+static int wifi_config_has_configuration() {
+        char *wifi_ssid = NULL;
+        sysparam_get_string("wifi_ssid", &wifi_ssid);
+
+        // wifi_config_reset() leaves an empty SSID behind
+        int configured = wifi_ssid && *wifi_ssid;
+        free(wifi_ssid);
+
+        return configured;
+}
+
+
+// Static addressing is saved with the credentials as
+// "ip,netmask,gateway[,dns]"
+static bool static_ip_parse(const char *text, esp_netif_ip_info_t *info, esp_ip4_addr_t *dns) {
+        char buffer[64];
+        if (!text || strlen(text) >= sizeof(buffer))
+                return false;
+        strcpy(buffer, text);
+
+        esp_ip4_addr_t *fields[] = { &info->ip, &info->netmask, &info->gw, dns };
+        dns->addr = 0;
+
+        int count = 0;
+        char *save = NULL;
+        for (char *token = strtok_r(buffer, ",", &save); token; token = strtok_r(NULL, ",", &save)) {
+                if (count == 4 || esp_netif_str_to_ip4(token, fields[count]) != ESP_OK)
+                        return false;
+                count++;
+        }
+
+        return count >= 3 && info->ip.addr && info->netmask.addr;
+}
+
+
+static void wifi_config_save(const char *ssid, const char *password, const char *static_ip) {
+        sysparam_set_string("wifi_ssid", ssid);
+        sysparam_set_string("wifi_password", password);
+        sysparam_set_string("wifi_ip", static_ip);
+}
+
+
+// With CONFIG_LWIP_DHCP_RESTORE_LAST_IP, lwIP keeps the last lease in the
+// dhcp_state NVS namespace and REQUESTs it right after association
+// (INIT-REBOOT) instead of starting over with DISCOVER. A lease is only
+// worth asking for on the network that granted it, so the SSID it belongs
+// to is kept next to it and a lease from another network is dropped.
+// Trial attempts leave it alone, so a trial that fails costs the saved
+// network nothing; one that succeeds adopts the lease lwIP stored for it.
+static void wifi_config_lease_select(const char *ssid) {
+#ifdef CONFIG_LWIP_DHCP_RESTORE_LAST_IP
+        char *lease_ssid = NULL;
+        sysparam_get_string("wifi_lease_ssid", &lease_ssid);
+        if (!lease_ssid || strcmp(lease_ssid, ssid)) {
+                nvs_handle_t handle;
+                if (nvs_open("dhcp_state", NVS_READWRITE, &handle) == ESP_OK) {
+                        nvs_erase_all(handle);
+                        nvs_commit(handle);
+                        nvs_close(handle);
+                }
+                sysparam_set_string("wifi_lease_ssid", ssid);
+        }
+        free(lease_ssid);
+#endif
+}
+
+
+static void wifi_config_lease_adopt(const char *ssid) {
+#ifdef CONFIG_LWIP_DHCP_RESTORE_LAST_IP
+        sysparam_set_string("wifi_lease_ssid", ssid);
+#endif
+}
+
+
+static void wifi_config_sta_addressing(const char *ssid, const char *static_ip, bool trial) {
+        esp_netif_ip_info_t ip_info;
+        esp_ip4_addr_t dns;
+        if (static_ip && *static_ip && static_ip_parse(static_ip, &ip_info, &dns)) {
+                // No DHCP round trips at all, the netif reports the address
+                // as soon as the station is associated
+                esp_netif_dhcpc_stop(sta_netif);
+                esp_netif_set_ip_info(sta_netif, &ip_info);
+                if (dns.addr) {
+                        esp_netif_dns_info_t dns_info = {
+                                .ip.u_addr.ip4 = dns,
+                                .ip.type = ESP_IPADDR_TYPE_V4,
+                        };
+                        esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &dns_info);
+                }
+                return;
+        }
+
+        if (!trial)
+                wifi_config_lease_select(ssid);
+        esp_netif_dhcpc_start(sta_netif);
+}
+
+
+static int wifi_config_station_connect() {
+        char *wifi_ssid = NULL;
+        char *wifi_password = NULL;
+        char *wifi_static_ip = NULL;
+        bool trial = false;
+
+        xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+        if (context->trial_state == TRIAL_CONNECTING) {
+                trial = true;
+                wifi_ssid = strdup(context->trial_ssid);
+                if (context->trial_password)
+                        wifi_password = strdup(context->trial_password);
+                if (context->trial_static_ip)
+                        wifi_static_ip = strdup(context->trial_static_ip);
+        }
+        xSemaphoreGive(context->trial_lock);
+
+        if (!wifi_ssid) {
+                sysparam_get_string("wifi_ssid", &wifi_ssid);
+                sysparam_get_string("wifi_password", &wifi_password);
+                sysparam_get_string("wifi_ip", &wifi_static_ip);
+        }
+
+        if (!wifi_ssid || !*wifi_ssid) {
+                ERROR("No configuration found");
+                free(wifi_ssid);
+                if (wifi_password)
+                        free(wifi_password);
+                free(wifi_static_ip);
+                return -1;
+        }
+
+        INFO("Connecting to %s", wifi_ssid);
+
+        wifi_config_t sta_config;
+        memset(&sta_config, 0, sizeof(sta_config));
+        strncpy((char *)sta_config.sta.ssid, wifi_ssid, sizeof(sta_config.sta.ssid));
+        sta_config.sta.ssid[sizeof(sta_config.sta.ssid)-1] = 0;
+        if (wifi_password)
+                strncpy((char *)sta_config.sta.password, wifi_password, sizeof(sta_config.sta.password));
+#if !defined(WIFI_CONFIG_NO_ROAMING) && defined(CONFIG_WPA_11KV_SUPPORT)
+        // Let the AP steer us with 802.11k neighbor reports and 802.11v BSS
+        // transition requests
+        sta_config.sta.rm_enabled = 1;
+        sta_config.sta.btm_enabled = 1;
+#endif
+
+        // Reapplying an unchanged config makes the driver reset the station.
+        // A BSSID pinned by roaming is released on the next regular connect.
+        wifi_config_t current_config;
+        if (esp_wifi_get_config(WIFI_IF_STA, &current_config) != ESP_OK ||
+            current_config.sta.bssid_set ||
+            strncmp((char *)current_config.sta.ssid, (char *)sta_config.sta.ssid, sizeof(sta_config.sta.ssid)) ||
+            strncmp((char *)current_config.sta.password, (char *)sta_config.sta.password, sizeof(sta_config.sta.password))) {
+                sdk_wifi_station_set_config(&sta_config);
+        }
+
+        wifi_config_sta_addressing(wifi_ssid, wifi_static_ip, trial);
+
+        sta_connect_started = esp_timer_get_time();
+        sta_connecting = true;
+        metrics_add(METRIC_CONNECT_ATTEMPTS, 1);
+        wifi_config_portal_event(PORTAL_EVENT_ASSOCIATING, 0);
+        sdk_wifi_station_connect();
+        sdk_wifi_station_set_auto_connect(true);
+
+        free(wifi_ssid);
+        if (wifi_password)
+                free(wifi_password);
+        free(wifi_static_ip);
+
+        return 0;
+}
+
+
+static void wifi_config_connect_arm(uint32_t delay_ms) {
+        esp_timer_stop(context->connect_timer);
+        esp_timer_start_once(context->connect_timer, (uint64_t) delay_ms * 1000);
+}
 
-                                const int maxpkt = 4; /* Drop connection after 4 probes without response */
-                                setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &maxpkt, sizeof(maxpkt));
 
-                                client_t *client = client_new();
-                                client->fd = fd;
-                                client->next = clients;
+// Time the attempt in flight may still take, 0 if there is none or it
+// has been superseded by new credentials
+static uint32_t wifi_config_attempt_remaining() {
+        if (!sta_connecting || context->connect_preempt)
+                return 0;
 
-                                clients = client;
+        int64_t elapsed = (esp_timer_get_time() - sta_connect_started) / 1000;
+        return elapsed < WIFI_CONFIG_CONNECT_ATTEMPT_TIME ? WIFI_CONFIG_CONNECT_ATTEMPT_TIME - elapsed : 0;
+}
 
-                                FD_SET(fd, &fds);
-                                if (fd > max_fd)
-                                        max_fd = fd;
-                        }
 
-                        triggered_nfds--;
+static void wifi_config_connect_timer_callback(void *arg) {
+        bool radio_locked = xSemaphoreTake(context->radio_lock, 0) == pdTRUE;
+
+        uint32_t delay = 0;
+        provision_connect_t decision = provision_connect_due(
+                sta_got_ip, wifi_config_attempt_remaining(),
+                context->http_requests_in_flight > 0, !radio_locked, &delay);
+        if (decision != PROVISION_CONNECT_ATTEMPT) {
+                if (radio_locked)
+                        xSemaphoreGive(context->radio_lock);
+                if (decision == PROVISION_CONNECT_DEFER) {
+                        DEBUG("Attempt in flight or portal busy, deferring connect attempt by %u ms",
+                              (unsigned) delay);
+                        wifi_config_connect_arm(delay);
                 }
+                return;
+        }
 
-                client_t *c = clients;
-                while (c && triggered_nfds) {
-                        if (FD_ISSET(c->fd, &read_fds)) {
-                                triggered_nfds--;
+        context->connect_preempt = false;
+        int result = wifi_config_station_connect();
+        xSemaphoreGive(context->radio_lock);
+        if (result)
+                return;
 
-                                int data_len = lwip_read(c->fd, data, sizeof(data));
-                                if (data_len <= 0) {
-                                        DEBUG("Client %d disconnected", c->fd);
-                                        c->disconnected = true;
-                                } else {
-                                        DEBUG("Client %d got %d incomming data", c->fd, data_len);
-                                        http_parser_execute(
-                                                &c->parser, &wifi_config_http_parser_settings,
-                                                data, data_len
-                                                );
-                                }
-                        }
+        delay = provision_connect_started(&context->provision, &provision_config, esp_random());
+        DEBUG("Next connect attempt in %u ms", (unsigned) delay);
 
-                        c = c->next;
-                }
+        wifi_config_connect_arm(delay);
+}
 
-                while (clients && clients->disconnected) {
-                        c = clients;
-                        clients = clients->next;
 
-                        FD_CLR(c->fd, &fds);
-                        lwip_close(c->fd);
-                        client_free(c);
-                }
-                if (clients) {
-                        c = clients;
+static void wifi_config_connect_schedule() {
+        if (!esp_timer_is_active(context->connect_timer))
+                wifi_config_connect_arm(0);
+}
 
-                        max_fd = listenfd;
-                        if (c->fd > max_fd)
-                                max_fd = c->fd;
 
-                        while (c->next) {
-                                if (c->next->fd > max_fd)
-                                        max_fd = c->next->fd;
+static void wifi_config_connect_now() {
+        provision_backoff_reset(&context->provision, &provision_config);
+        context->connect_preempt = true;
+        wifi_config_connect_arm(0);
+}
 
-                                if (c->next->disconnected) {
-                                        client_t *tmp = c->next;
-                                        c->next = tmp->next;
 
-                                        FD_CLR(tmp->fd, &fds);
-                                        lwip_close(tmp->fd);
-                                        client_free(tmp);
-                                } else {
-                                        c = c->next;
-                                }
-                        }
-                }
+static void wifi_config_trial_clear_credentials() {
+        if (context->trial_ssid) {
+                free(context->trial_ssid);
+                context->trial_ssid = NULL;
         }
+        if (context->trial_password) {
+                free(context->trial_password);
+                context->trial_password = NULL;
+        }
+        if (context->trial_static_ip) {
+                free(context->trial_static_ip);
+                context->trial_static_ip = NULL;
+        }
+}
 
-        INFO("Stopping HTTP server");
-
-        while (clients) {
-                client_t *c = clients;
-                clients = c->next;
 
-                lwip_close(c->fd);
-                client_free(c);
+static void wifi_config_trial_fail(uint8_t reason) {
+        xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+        if (context->trial_state != TRIAL_CONNECTING) {
+                xSemaphoreGive(context->trial_lock);
+                return;
         }
 
-        lwip_close(listenfd);
-        vTaskDelete(NULL);
-}
+        INFO("Failed to connect to %s (reason %d)", context->trial_ssid, reason);
+        context->trial_state = TRIAL_FAILED;
+        context->trial_reason = reason;
+        wifi_config_trial_clear_credentials();
+        xSemaphoreGive(context->trial_lock);
 
+        wifi_config_portal_event(PORTAL_EVENT_FAILED, reason);
 
-static void http_start() {
-        xTaskCreate(http_task, "wifi_config HTTP", 8192, NULL, 2, &context->http_task_handle);
+        esp_timer_stop(context->trial_timer);
+        esp_wifi_disconnect();
 }
 
 
-static void http_stop() {
-        if (!context->http_task_handle)
-                return;
-
-        xTaskNotify(context->http_task_handle, 1, eSetValueWithOverwrite);
+static void wifi_config_trial_timer_callback(void *arg) {
+        wifi_config_trial_fail(context->trial_reason);
 }
 
 
-static void dns_task(void *arg)
-{
-        INFO("Starting DNS server");
+static void wifi_config_trial_start(const char *ssid, const char *password, const char *static_ip) {
+        xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+        wifi_config_trial_clear_credentials();
+        context->trial_ssid = strdup(ssid ? ssid : "");
+        if (password)
+                context->trial_password = strdup(password);
+        if (static_ip)
+                context->trial_static_ip = strdup(static_ip);
+        context->trial_state = TRIAL_CONNECTING;
+        context->trial_reason = 0;
+        xSemaphoreGive(context->trial_lock);
+
+        esp_timer_stop(context->trial_timer);
+        esp_timer_start_once(context->trial_timer, WIFI_CONFIG_CONNECT_TIMEOUT * 1000LL);
 
-        ip4_addr_t server_addr;
-        IP4_ADDR(&server_addr, 192, 168, 4, 1);
+        wifi_config_connect_now();
+}
 
-        struct sockaddr_in serv_addr;
-        int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
 
-        memset(&serv_addr, '0', sizeof(serv_addr));
-        serv_addr.sin_family = AF_INET;
-        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        serv_addr.sin_port = htons(53);
-        bind(fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr));
+// Credentials committed without a trial replace one in flight. Otherwise
+// the next attempt would still dial the trial network, and its IP would
+// overwrite what was just saved.
+static void wifi_config_trial_cancel() {
+        xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+        context->trial_state = TRIAL_IDLE;
+        wifi_config_trial_clear_credentials();
+        xSemaphoreGive(context->trial_lock);
 
-        const struct timeval timeout = { 2, 0 }; /* 2 second timeout */
-        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        esp_timer_stop(context->trial_timer);
+}
 
-        const struct ifreq ifreq1 = { "en1" };
-        setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, &ifreq1, sizeof(ifreq1));
 
-        for (;;) {
-                char buffer[96];
-                struct sockaddr src_addr;
-                socklen_t src_addr_len = sizeof(src_addr);
-                size_t count = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&src_addr, &src_addr_len);
-
-                /* Drop messages that are too large to send a response in the buffer */
-                if (count > 0 && count <= sizeof(buffer) - 16 && src_addr.sa_family == AF_INET) {
-                        size_t qname_len = strlen(buffer + 12) + 1;
-                        uint32_t reply_len = 2 + 10 + qname_len + 16 + 4;
-
-                        char *head = buffer + 2;
-                        *head++ = 0x80; // Flags
-                        *head++ = 0x00;
-                        *head++ = 0x00; // Q count
-                        *head++ = 0x01;
-                        *head++ = 0x00; // A count
-                        *head++ = 0x01;
-                        *head++ = 0x00; // Auth count
-                        *head++ = 0x00;
-                        *head++ = 0x00; // Add count
-                        *head++ = 0x00;
-                        head += qname_len;
-                        *head++ = 0x00; // Q type
-                        *head++ = 0x01;
-                        *head++ = 0x00; // Q class
-                        *head++ = 0x01;
-                        *head++ = 0xC0; // LBL offs
-                        *head++ = 0x0C;
-                        *head++ = 0x00; // Type
-                        *head++ = 0x01;
-                        *head++ = 0x00; // Class
-                        *head++ = 0x01;
-                        *head++ = 0x00; // TTL
-                        *head++ = 0x00;
-                        *head++ = 0x00;
-                        *head++ = 0x78;
-                        *head++ = 0x00; // RD len
-                        *head++ = 0x04;
-                        *head++ = ip4_addr1(&server_addr);
-                        *head++ = ip4_addr2(&server_addr);
-                        *head++ = ip4_addr3(&server_addr);
-                        *head++ = ip4_addr4(&server_addr);
-
-                        DEBUG("Got DNS query, sending response");
-                        sendto(fd, buffer, reply_len, 0, &src_addr, src_addr_len);
+static void wifi_config_trial_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data) {
+        if (!context || context->trial_state != TRIAL_CONNECTING)
+                return;
+
+        if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+                xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+                if (context->trial_state == TRIAL_CONNECTING) {
+                        INFO("Connected to %s, saving configuration", context->trial_ssid);
+                        wifi_config_save(context->trial_ssid, context->trial_password,
+                                         context->trial_static_ip);
+                        if (!context->trial_static_ip)
+                                wifi_config_lease_adopt(context->trial_ssid);
+                        context->trial_state = TRIAL_CONNECTED;
+                        wifi_config_trial_clear_credentials();
                 }
+                xSemaphoreGive(context->trial_lock);
 
-                uint32_t task_value = 0;
-                if (xTaskNotifyWait(0, 1, &task_value, 0) == pdTRUE) {
-                        if (task_value)
-                                break;
+                esp_timer_stop(context->trial_timer);
+        } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+                wifi_event_sta_disconnected_t *event = event_data;
+                context->trial_reason = event->reason;
+
+                // Wrong credentials won't get better by retrying until the timeout
+                switch (event->reason) {
+                case WIFI_REASON_AUTH_FAIL:
+                case WIFI_REASON_4WAY_HANDSHAKE_TIMEOUT:
+                case WIFI_REASON_HANDSHAKE_TIMEOUT:
+                        wifi_config_trial_fail(event->reason);
+                        break;
+                default:
+                        break;
                 }
         }
+}
 
-        INFO("Stopping DNS server");
 
-        lwip_close(fd);
+static const roaming_config_t roaming_config = {
+        .rssi_threshold = WIFI_CONFIG_ROAM_RSSI_THRESHOLD,
+        .hysteresis = WIFI_CONFIG_ROAM_HYSTERESIS,
+        .scan_budget = WIFI_CONFIG_ROAM_SCAN_BUDGET,
+        .scan_window = WIFI_CONFIG_ROAM_SCAN_WINDOW,
+};
 
-        vTaskDelete(NULL);
-}
 
+static void wifi_config_roaming_timer_callback(void *arg) {
+        wifi_ap_record_t ap_info;
+        if (!sta_got_ip || esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK)
+                return;
 
-static void dns_start() {
-        xTaskCreate(dns_task, "wifi_config DNS", 4096, NULL, 2, &context->dns_task_handle);
-}
+        roaming_add_rssi_sample(&context->roaming, ap_info.rssi);
 
+        uint32_t now = esp_timer_get_time() / 1000;
+        if (context->roaming_scan_pending || !roaming_should_scan(&context->roaming, &roaming_config, now))
+                return;
 
-static void dns_stop() {
-        if (!context->dns_task_handle)
+        if (xSemaphoreTake(context->radio_lock, 0) != pdTRUE)
                 return;
 
-        xTaskNotify(context->dns_task_handle, 1, eSetValueWithOverwrite);
+        DEBUG("RSSI average %d dBm, scanning for a better BSS", roaming_rssi(&context->roaming));
+
+        // Short active dwell keeps the radio off channel as briefly as possible
+        wifi_scan_config_t scan_config = {
+                .ssid = ap_info.ssid,
+                .scan_type = WIFI_SCAN_TYPE_ACTIVE,
+                .scan_time.active = { .min = 0, .max = 60 },
+        };
+        // The lock is held until the scan's SCAN_DONE, so no portal scan or
+        // connect attempt can start in between and take over its results
+        context->roaming_scan_pending = true;
+        if (esp_wifi_scan_start(&scan_config, false) != ESP_OK) {
+                context->roaming_scan_pending = false;
+                xSemaphoreGive(context->radio_lock);
+        }
 }
 
 
-static void wifi_config_softap_start() {
-        INFO("Starting AP mode");
+static void wifi_config_roaming_on_scan_done() {
+        wifi_ap_record_t ap_info;
+        uint16_t ap_num = 0;
+        esp_wifi_scan_get_ap_num(&ap_num);
 
-        sdk_wifi_set_opmode(STATIONAP_MODE);
+        wifi_ap_record_t *records = calloc(ap_num, sizeof(wifi_ap_record_t));
+        roaming_candidate_t *candidates = calloc(ap_num, sizeof(roaming_candidate_t));
+        if (!records || !candidates || esp_wifi_scan_get_ap_records(&ap_num, records) != ESP_OK ||
+            esp_wifi_sta_get_ap_info(&ap_info) != ESP_OK) {
+                free(records);
+                free(candidates);
+                return;
+        }
 
-        uint8_t macaddr[6];
-        sdk_wifi_get_macaddr(SOFTAP_IF, macaddr);
+        for (int i = 0; i < ap_num; i++) {
+                memcpy(candidates[i].bssid, records[i].bssid, sizeof(candidates[i].bssid));
+                candidates[i].rssi = records[i].rssi;
+        }
 
-        wifi_config_t ap_cfg;
-        sdk_wifi_softap_get_config(&ap_cfg);
-        ap_cfg.ap.ssid_len = snprintf(
-                (char *)ap_cfg.ap.ssid, sizeof(ap_cfg.ap.ssid),
-                "%s-%02X%02X%02X", context->ssid_prefix, macaddr[3], macaddr[4], macaddr[5]
-                );
-        ap_cfg.ap.ssid_hidden = 0;
-        if (context->password) {
-                ap_cfg.ap.authmode = WIFI_AUTH_WPA_WPA2_PSK;
-                strncpy((char *)ap_cfg.ap.password,
-                        context->password, sizeof(ap_cfg.ap.password));
-        } else {
-                ap_cfg.ap.authmode = WIFI_AUTH_OPEN;
+        int best = roaming_pick_candidate(&context->roaming, &roaming_config,
+                                          ap_info.bssid, candidates, ap_num);
+        if (best >= 0) {
+                INFO("Roaming to %02x:%02x:%02x:%02x:%02x:%02x (%d dBm, current average %d dBm)",
+                     records[best].bssid[0], records[best].bssid[1], records[best].bssid[2],
+                     records[best].bssid[3], records[best].bssid[4], records[best].bssid[5],
+                     records[best].rssi, roaming_rssi(&context->roaming));
+
+                wifi_config_t sta_config;
+                esp_wifi_get_config(WIFI_IF_STA, &sta_config);
+                sta_config.sta.bssid_set = true;
+                memcpy(sta_config.sta.bssid, records[best].bssid, sizeof(sta_config.sta.bssid));
+                sta_config.sta.channel = records[best].primary;
+                sdk_wifi_station_set_config(&sta_config);
+
+                roaming_reset(&context->roaming);
+                esp_wifi_disconnect();
+                esp_wifi_connect();
         }
-        ap_cfg.ap.max_connection = 2;
-        ap_cfg.ap.beacon_interval = 100;
 
-        DEBUG("Starting AP SSID=%s", ap_cfg.ap.ssid);
+        free(records);
+        free(candidates);
+}
 
-        sdk_wifi_softap_set_config(&ap_cfg);
 
-        wifi_networks_mutex = xSemaphoreCreateBinary();
-        xSemaphoreGive(wifi_networks_mutex);
+static void wifi_config_roaming_on_event(esp_event_base_t event_base, int32_t event_id, void *event_data) {
+        if (!context)
+                return;
 
-        xTaskCreate(wifi_scan_task, "wifi_config scan", 4096, NULL, 2, NULL);
+        if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE && context->roaming_scan_pending) {
+                context->roaming_scan_pending = false;
+                wifi_config_roaming_on_scan_done();
+                xSemaphoreGive(context->radio_lock);
+        } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+                roaming_reset(&context->roaming);
+        }
+}
 
-        INFO("Starting AP interface");
 
-        dns_start();
-        http_start();
+static void wifi_config_roaming_start() {
+#ifndef WIFI_CONFIG_NO_ROAMING
+        if (!esp_timer_is_active(context->roaming_timer)) {
+                roaming_reset(&context->roaming);
+                esp_timer_start_periodic(context->roaming_timer, WIFI_CONFIG_ROAM_SAMPLE_INTERVAL * 1000LL);
+        }
+#endif
 }
 
 
-static void wifi_config_softap_stop() {
-        dns_stop();
-        http_stop();
-        sdk_wifi_set_opmode(STATION_MODE);
+static void wifi_config_roaming_stop() {
+        esp_timer_stop(context->roaming_timer);
 }
 
 
-static void wifi_config_monitor_callback(TimerHandle_t xTimer) {
-        if (sdk_wifi_station_get_connect_status() == STATION_GOT_IP) {
-                if (sdk_wifi_get_opmode() == STATION_MODE && !context->first_time)
-                        return;
-
-                // Connected to station, all is dandy
-                INFO("Connected to WiFi network");
+static void wifi_config_monitor_now(void *arg, uint32_t unused) {
+        if (context)
+                wifi_config_monitor_callback(context->network_monitor_timer);
+}
 
-                wifi_config_softap_stop();
-                sdk_wifi_station_set_auto_connect(false);
 
-                if (context->on_event)
-                        context->on_event(WIFI_CONFIG_CONNECTED);
+static void wifi_config_liveness_arm(uint32_t delay_ms) {
+        esp_timer_stop(context->liveness_timer);
+        esp_timer_start_once(context->liveness_timer, delay_ms * 1000LL);
+}
 
-                context->first_time = false;
 
-                // change monitoring poll interval
-                xTimerChangePeriod(
-                        context->network_monitor_timer,
-                        pdMS_TO_TICKS(WIFI_CONFIG_CONNECTED_MONITOR_INTERVAL), 0);
+// Two phases so the esp_timer task never blocks: send a probe and come back
+// after the timeout to collect the answer.
+static void wifi_config_liveness_timer_callback(void *arg) {
+        liveness_config_t *config = &context->liveness_config;
 
+        if (!sta_got_ip) {
+                // Between a drop and the next IP, possibly behind another gateway
+                context->liveness_probe_sent = false;
+                liveness_reset(&context->liveness);
+                wifi_config_liveness_arm(config->interval);
                 return;
-        } else {
-                if (wifi_config_has_configuration())
-                        wifi_config_station_connect();
+        }
 
-                if (sdk_wifi_get_opmode() != STATION_MODE)
-                        return;
+        if (!context->liveness_probe_sent) {
+                if (context->liveness_fd < 0)
+                        context->liveness_fd = liveness_probe_open();
 
-                INFO("Disconnected from WiFi network");
+                context->liveness_probe_id++;
+                if (context->liveness_fd >= 0)
+                        liveness_probe_send(context->liveness_fd, sta_ip_info.gw.addr, 0,
+                                            context->liveness_probe_id);
+                context->liveness_probe_sent = true;
+                wifi_config_liveness_arm(config->timeout);
+                return;
+        }
 
-                if (!context->first_time && context->on_event)
-                        context->on_event(WIFI_CONFIG_DISCONNECTED);
+        context->liveness_probe_sent = false;
+        bool answered = context->liveness_fd >= 0 &&
+                        liveness_probe_answered(context->liveness_fd, context->liveness_probe_id);
 
-                // change monitoring poll interval
-                xTimerChangePeriod(
-                        context->network_monitor_timer,
-                        pdMS_TO_TICKS(WIFI_CONFIG_DISCONNECTED_MONITOR_INTERVAL), 0);
+        uint32_t next_probe = 0;
+        switch (liveness_on_result(&context->liveness, config, answered, &next_probe)) {
+        case LIVENESS_SUSPECT:
+                DEBUG("Gateway missed %d liveness probe(s)", context->liveness.misses);
+                break;
+        case LIVENESS_DEAD:
+                INFO("Gateway stopped answering, dropping the connection");
+                metrics_add(METRIC_LIVENESS_FAILURES, 1);
+                wifi_config_liveness_stop();
 
-                wifi_config_softap_start();
+                // The monitor sees the drop right away instead of on its next
+                // connected-mode poll, and reconnects or raises the portal
+                sta_got_ip = false;
+                esp_wifi_disconnect();
+                xTimerPendFunctionCall(wifi_config_monitor_now, NULL, 0, 0);
+                return;
+        case LIVENESS_UNSUPPORTED:
+                INFO("Gateway does not answer liveness probes, probing disabled");
+                wifi_config_liveness_stop();
+                return;
+        default:
+                break;
         }
-}
 
+        wifi_config_liveness_arm(next_probe);
+}
 
-static int wifi_config_has_configuration() {
-        char *wifi_ssid = NULL;
-        sysparam_get_string("wifi_ssid", &wifi_ssid);
 
-        if (!wifi_ssid) {
-                return 0;
+static void wifi_config_liveness_start() {
+#ifdef WIFI_CONFIG_LIVENESS
+        if (!esp_timer_is_active(context->liveness_timer)) {
+                liveness_reset(&context->liveness);
+                context->liveness_probe_sent = false;
+                wifi_config_liveness_arm(context->liveness_config.interval);
         }
-
-        free(wifi_ssid);
-
-        return 1;
+#endif
 }
 
 
-static int wifi_config_station_connect() {
-        char *wifi_ssid = NULL;
-        char *wifi_password = NULL;
-        sysparam_get_string("wifi_ssid", &wifi_ssid);
-        sysparam_get_string("wifi_password", &wifi_password);
-
-        if (!wifi_ssid) {
-                ERROR("No configuration found");
-                if (wifi_password)
-                        free(wifi_password);
-                return -1;
+static void wifi_config_liveness_stop() {
+        if (context->liveness_timer)
+                esp_timer_stop(context->liveness_timer);
+        context->liveness_probe_sent = false;
+        if (context->liveness_fd >= 0) {
+                liveness_probe_close(context->liveness_fd);
+                context->liveness_fd = -1;
         }
+}
 
-        INFO("Connecting to %s", wifi_ssid);
 
-        wifi_config_t sta_config;
-        memset(&sta_config, 0, sizeof(sta_config));
-        strncpy((char *)sta_config.sta.ssid, wifi_ssid, sizeof(sta_config.sta.ssid));
-        sta_config.sta.ssid[sizeof(sta_config.sta.ssid)-1] = 0;
-        if (wifi_password)
-                strncpy((char *)sta_config.sta.password, wifi_password, sizeof(sta_config.sta.password));
+void wifi_config_start() {
+        wifi_config_init_wifi();
+        sdk_wifi_set_opmode(STATION_MODE);
 
-        sdk_wifi_station_set_config(&sta_config);
+        provision_init(&context->provision, &provision_config, esp_timer_get_time() / 1000);
 
-        sdk_wifi_station_connect();
-        sdk_wifi_station_set_auto_connect(true);
+        if (!context->radio_lock) {
+                context->radio_lock = xSemaphoreCreateBinary();
+                if (context->radio_lock)
+                        xSemaphoreGive(context->radio_lock);
+        }
+        if (!context->trial_lock)
+                context->trial_lock = xSemaphoreCreateMutex();
+        if (!context->portal_event_queue)
+                context->portal_event_queue = xQueueCreate(8, sizeof(portal_event_t));
+        if (!context->event_queue)
+                context->event_queue = xQueueCreate(WIFI_CONFIG_EVENT_QUEUE_LENGTH, sizeof(event_message_t));
+        if (!context->event_task_handle) {
+                xTaskCreate(wifi_config_event_task, "wifi_config_events", WIFI_CONFIG_EVENT_TASK_STACK_SIZE,
+                            NULL, WIFI_CONFIG_EVENT_TASK_PRIORITY, &context->event_task_handle);
+        }
 
-        free(wifi_ssid);
-        if (wifi_password)
-                free(wifi_password);
+        if (!context->trial_timer) {
+                const esp_timer_create_args_t trial_timer_args = {
+                        .callback = wifi_config_trial_timer_callback,
+                        .name = "wifi_cfg_trial",
+                };
+                esp_timer_create(&trial_timer_args, &context->trial_timer);
+        }
 
-        return 0;
-}
+        if (!context->roaming_timer) {
+                const esp_timer_create_args_t roaming_timer_args = {
+                        .callback = wifi_config_roaming_timer_callback,
+                        .name = "wifi_cfg_roam",
+                };
+                esp_timer_create(&roaming_timer_args, &context->roaming_timer);
+        }
 
+#ifdef WIFI_CONFIG_LIVENESS
+        if (!context->liveness_timer) {
+                liveness_config_init(&context->liveness_config, WIFI_CONFIG_LIVENESS_DETECT_TIME,
+                                     WIFI_CONFIG_LIVENESS_PROBES_PER_MINUTE,
+                                     WIFI_CONFIG_LIVENESS_TIMEOUT, WIFI_CONFIG_LIVENESS_MISSES);
+                DEBUG("Liveness probes every %u ms, link failures detected within %u ms",
+                      (unsigned) context->liveness_config.interval,
+                      (unsigned) liveness_detect_time(&context->liveness_config));
+
+                const esp_timer_create_args_t liveness_timer_args = {
+                        .callback = wifi_config_liveness_timer_callback,
+                        .name = "wifi_cfg_live",
+                };
+                esp_timer_create(&liveness_timer_args, &context->liveness_timer);
+        }
+#endif
 
-void wifi_config_start() {
-        wifi_config_init_wifi();
-        sdk_wifi_set_opmode(STATION_MODE);
+        if (!context->connect_timer) {
+                const esp_timer_create_args_t connect_timer_args = {
+                        .callback = wifi_config_connect_timer_callback,
+                        .name = "wifi_cfg_connect",
+                };
+                esp_timer_create(&connect_timer_args, &context->connect_timer);
+        }
 
-        context->first_time = true;
+        if (!context->portal_park_timer) {
+                context->portal_park_timer = xTimerCreate(
+                        "wifi_cfg_park",
+                        pdMS_TO_TICKS(WIFI_CONFIG_PORTAL_PARK_DELAY),
+                        pdFALSE,
+                        NULL,
+                        portal_park_timer_callback);
+        }
 
-        if (wifi_config_station_connect()) {
+        if (wifi_config_has_configuration()) {
+                wifi_config_connect_now();
+        } else {
                 wifi_config_softap_start();
         }
 
@@ -964,6 +3455,94 @@ void wifi_config_start() {
 }
 
 
+static void wifi_config_portal_open_now(void *arg, uint32_t unused) {
+        if (!context)
+                return;
+
+        xSemaphoreTake(context->trial_lock, portMAX_DELAY);
+        if (context->trial_state != TRIAL_CONNECTING)
+                context->trial_state = TRIAL_IDLE;
+        xSemaphoreGive(context->trial_lock);
+
+        INFO("Opening the portal for %d s", WIFI_CONFIG_PORTAL_OPEN_TIME / 1000);
+        context->portal_open_until = esp_timer_get_time() + WIFI_CONFIG_PORTAL_OPEN_TIME * 1000LL;
+        wifi_config_softap_start();
+}
+
+
+// Runs on the timer service task like the monitor, so the two never race
+void wifi_config_portal_open() {
+        if (!context) {
+                ERROR("Cannot open the portal, WiFi configuration not initialised yet");
+                return;
+        }
+
+        xTimerPendFunctionCall(wifi_config_portal_open_now, NULL, 0, 0);
+}
+
+
+static void wifi_config_monitor_synced(void *semaphore, uint32_t unused) {
+        xSemaphoreGive((SemaphoreHandle_t) semaphore);
+}
+
+
+void wifi_config_deinit() {
+        if (!context)
+                return;
+
+        INFO("Deinitializing WiFi config");
+
+        if (context->portal_park_timer)
+                xTimerDelete(context->portal_park_timer, portMAX_DELAY);
+
+        if (context->network_monitor_timer) {
+                xTimerDelete(context->network_monitor_timer, portMAX_DELAY);
+
+                // Wait for the timer service task to process the delete, so the
+                // monitor callback cannot run against a freed context
+                SemaphoreHandle_t synced = xSemaphoreCreateBinary();
+                if (synced && xTimerPendFunctionCall(wifi_config_monitor_synced, synced, 0, portMAX_DELAY) == pdPASS)
+                        xSemaphoreTake(synced, portMAX_DELAY);
+                if (synced)
+                        vSemaphoreDelete(synced);
+        }
+
+        wifi_config_softap_stop();
+        wifi_config_event_task_stop();
+
+        if (context->connect_timer) {
+                esp_timer_stop(context->connect_timer);
+                esp_timer_delete(context->connect_timer);
+        }
+        if (context->radio_lock)
+                vSemaphoreDelete(context->radio_lock);
+        if (context->trial_timer) {
+                esp_timer_stop(context->trial_timer);
+                esp_timer_delete(context->trial_timer);
+        }
+        if (context->roaming_timer) {
+                esp_timer_stop(context->roaming_timer);
+                esp_timer_delete(context->roaming_timer);
+        }
+        wifi_config_liveness_stop();
+        if (context->liveness_timer)
+                esp_timer_delete(context->liveness_timer);
+        if (context->trial_lock)
+                vSemaphoreDelete(context->trial_lock);
+        if (context->portal_event_queue)
+                vQueueDelete(context->portal_event_queue);
+        if (context->event_queue)
+                vQueueDelete(context->event_queue);
+        wifi_config_trial_clear_credentials();
+
+        free(context->ssid_prefix);
+        if (context->password)
+                free(context->password);
+        free(context);
+        context = NULL;
+}
+
+
 void wifi_config_legacy_support_on_event(wifi_config_event_t event) {
         if (event == WIFI_CONFIG_CONNECTED) {
                 if (context->on_wifi_ready) {
@@ -972,6 +3551,7 @@ void wifi_config_legacy_support_on_event(wifi_config_event_t event) {
         }
 #ifndef WIFI_CONFIG_NO_RESTART
         else if (event == WIFI_CONFIG_DISCONNECTED) {
+                async_log_flush(500);
                 esp_restart();
         }
 #endif
@@ -985,8 +3565,11 @@ void wifi_config_init(const char *ssid_prefix, const char *password, void (*on_w
                 return;
         }
 
+        wifi_config_deinit();
+
         context = malloc(sizeof(wifi_config_context_t));
         memset(context, 0, sizeof(*context));
+        context->liveness_fd = -1;
 
         context->ssid_prefix = strndup(ssid_prefix, 33-7);
         if (password)
@@ -1008,8 +3591,11 @@ void wifi_config_init2(const char *ssid_prefix, const char *password,
                 return;
         }
 
+        wifi_config_deinit();
+
         context = malloc(sizeof(wifi_config_context_t));
         memset(context, 0, sizeof(*context));
+        context->liveness_fd = -1;
 
         context->ssid_prefix = strndup(ssid_prefix, 33-7);
         if (password)
@@ -1022,8 +3608,7 @@ void wifi_config_init2(const char *ssid_prefix, const char *password,
 
 
 void wifi_config_reset() {
-        sysparam_set_string("wifi_ssid", "");
-        sysparam_set_string("wifi_password", "");
+        wifi_config_save("", "", "");
 }
 
 
@@ -1037,8 +3622,26 @@ void wifi_config_get(char **ssid, char **password) {
 
 
 void wifi_config_set(const char *ssid, const char *password) {
-        sysparam_set_string("wifi_ssid", ssid);
-        sysparam_set_string("wifi_password", password);
+        wifi_config_save(ssid, password, "");
+}
+
+
+int wifi_config_set_static_ip(const char *static_ip) {
+        esp_netif_ip_info_t ip_info;
+        esp_ip4_addr_t dns;
+        if (static_ip && *static_ip && !static_ip_parse(static_ip, &ip_info, &dns))
+                return -1;
+
+        sysparam_set_string("wifi_ip", static_ip);
+        return 0;
+}
+
+void wifi_config_get_extra(const char *key, char **value) {
+        if (!provision_extra_key_valid(key)) {
+                *value = NULL;
+                return;
+        }
+        sysparam_get_string(key, value);
 }
 
 void wifi_config_set_custom_html(char *html) {
@@ -1050,5 +3653,3 @@ void wifi_config_set_custom_html(char *html) {
         context->custom_html = html;
 }
 
-
-__attribute__((used)) static void *linker_keep_client_send_index = (void *)&client_send_index;
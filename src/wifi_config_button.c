@@ -0,0 +1,230 @@
+/**
+   Copyright 2025 Achim Pieters | StudioPieters®
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy
+   of this software and associated documentation files (the "Software"), to deal
+   in the Software without restriction, including without limitation the rights
+   to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+   copies of the Software, and to permit persons to whom the Software is
+   furnished to do so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NON INFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+   WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+   CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+   for more information visit https://www.studiopieters.nl
+ **/
+
+#include <stdlib.h>
+
+#include <driver/gpio.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+
+#include "wifi_config.h"
+#include "async_log.h"
+
+#define INFO(message, ...) ASYNC_LOG(ASYNC_LOG_INFO, ">>> wifi_config: " message "\n", ## __VA_ARGS__)
+#define ERROR(message, ...) ASYNC_LOG(ASYNC_LOG_ERROR, "!!! wifi_config: " message "\n", ## __VA_ARGS__)
+
+// Contacts must read the same level this long before an edge counts
+#ifndef WIFI_CONFIG_BUTTON_DEBOUNCE
+#define WIFI_CONFIG_BUTTON_DEBOUNCE 30
+#endif
+#ifndef WIFI_CONFIG_BUTTON_LONG_PRESS_TIME
+#define WIFI_CONFIG_BUTTON_LONG_PRESS_TIME 5000
+#endif
+
+
+// The interrupt masks itself and arms the debounce timer, which settles
+// the level and re-enables it, so nothing runs while the button is idle.
+// Long presses fire once the button has been held long enough, without
+// waiting for the release.
+typedef struct {
+        wifi_config_button_config_t config;
+        esp_timer_handle_t debounce_timer;
+        esp_timer_handle_t long_press_timer;
+        bool pressed;
+        bool long_press_fired;
+} button_t;
+
+static button_t *button = NULL;
+
+
+static bool button_is_pressed(button_t *b) {
+        return gpio_get_level(b->config.gpio) == (b->config.active_high ? 1 : 0);
+}
+
+
+static void button_isr(void *arg) {
+        button_t *b = arg;
+        gpio_intr_disable(b->config.gpio);
+        esp_timer_start_once(b->debounce_timer, WIFI_CONFIG_BUTTON_DEBOUNCE * 1000);
+}
+
+
+static void button_fire(button_t *b, bool long_press) {
+        wifi_config_button_action_t action = long_press ? b->config.long_press : b->config.short_press;
+        INFO("Button %s press", long_press ? "long" : "short");
+
+        if (b->config.on_press)
+                b->config.on_press(long_press, b->config.arg);
+
+        switch (action) {
+        case WIFI_CONFIG_BUTTON_PORTAL:
+                wifi_config_portal_open();
+                break;
+        case WIFI_CONFIG_BUTTON_RESET:
+                INFO("Forgetting the WiFi network");
+                wifi_config_reset();
+                /* fall through */
+        case WIFI_CONFIG_BUTTON_RESTART:
+                INFO("Restarting");
+                async_log_flush(500);
+                esp_restart();
+                break;
+        default:
+                break;
+        }
+}
+
+
+static void button_long_press_arm(button_t *b) {
+        b->long_press_fired = false;
+        esp_timer_stop(b->long_press_timer);
+        esp_timer_start_once(b->long_press_timer, b->config.long_press_time * 1000LL);
+}
+
+
+static void button_debounce_callback(void *arg) {
+        button_t *b = arg;
+        bool pressed = button_is_pressed(b);
+
+        if (pressed != b->pressed) {
+                b->pressed = pressed;
+                if (pressed) {
+                        button_long_press_arm(b);
+                } else {
+                        esp_timer_stop(b->long_press_timer);
+                        if (!b->long_press_fired)
+                                button_fire(b, false);
+                }
+        }
+
+        gpio_intr_enable(b->config.gpio);
+
+        // An edge while the interrupt was masked would go unnoticed
+        if (button_is_pressed(b) != b->pressed)
+                esp_timer_start_once(b->debounce_timer, WIFI_CONFIG_BUTTON_DEBOUNCE * 1000);
+}
+
+
+static void button_long_press_callback(void *arg) {
+        button_t *b = arg;
+        if (!b->pressed || !button_is_pressed(b))
+                return;
+
+        b->long_press_fired = true;
+        button_fire(b, true);
+}
+
+
+static void button_free(button_t *b) {
+        if (b->debounce_timer) {
+                esp_timer_stop(b->debounce_timer);
+                esp_timer_delete(b->debounce_timer);
+        }
+        if (b->long_press_timer) {
+                esp_timer_stop(b->long_press_timer);
+                esp_timer_delete(b->long_press_timer);
+        }
+        free(b);
+}
+
+
+int wifi_config_button_init(const wifi_config_button_config_t *config) {
+        if (!config || !GPIO_IS_VALID_GPIO(config->gpio)) {
+                ERROR("Invalid button GPIO");
+                return -1;
+        }
+
+        wifi_config_button_deinit();
+
+        button_t *b = calloc(1, sizeof(button_t));
+        if (!b)
+                return -1;
+
+        b->config = *config;
+        if (!b->config.long_press_time)
+                b->config.long_press_time = WIFI_CONFIG_BUTTON_LONG_PRESS_TIME;
+
+        const esp_timer_create_args_t debounce_timer_args = {
+                .callback = button_debounce_callback,
+                .arg = b,
+                .name = "wifi_cfg_btn",
+        };
+        const esp_timer_create_args_t long_press_timer_args = {
+                .callback = button_long_press_callback,
+                .arg = b,
+                .name = "wifi_cfg_btn_long",
+        };
+        if (esp_timer_create(&debounce_timer_args, &b->debounce_timer) != ESP_OK ||
+            esp_timer_create(&long_press_timer_args, &b->long_press_timer) != ESP_OK) {
+                ERROR("Failed to create button timers");
+                button_free(b);
+                return -1;
+        }
+
+        gpio_config_t io_config = {
+                .pin_bit_mask = 1ULL << config->gpio,
+                .mode = GPIO_MODE_INPUT,
+                .pull_up_en = config->active_high ? GPIO_PULLUP_DISABLE : GPIO_PULLUP_ENABLE,
+                .pull_down_en = config->active_high ? GPIO_PULLDOWN_ENABLE : GPIO_PULLDOWN_DISABLE,
+                .intr_type = GPIO_INTR_ANYEDGE,
+        };
+        if (gpio_config(&io_config) != ESP_OK) {
+                ERROR("Failed to configure button GPIO %d", config->gpio);
+                button_free(b);
+                return -1;
+        }
+
+        // The application may have installed the ISR service already
+        esp_err_t err = gpio_install_isr_service(0);
+        if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+                ERROR("Failed to install GPIO ISR service (%d)", err);
+                button_free(b);
+                return -1;
+        }
+
+        // A button held through boot counts as pressed from now on
+        b->pressed = button_is_pressed(b);
+        if (b->pressed)
+                button_long_press_arm(b);
+
+        if (gpio_isr_handler_add(config->gpio, button_isr, b) != ESP_OK) {
+                ERROR("Failed to add button interrupt handler");
+                button_free(b);
+                return -1;
+        }
+
+        button = b;
+        return 0;
+}
+
+
+void wifi_config_button_deinit() {
+        if (!button)
+                return;
+
+        gpio_intr_disable(button->config.gpio);
+        gpio_isr_handler_remove(button->config.gpio);
+
+        button_free(button);
+        button = NULL;
+}
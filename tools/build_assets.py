@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+import argparse
+import mimetypes
+import os
+import struct
+import zlib
+
+# Packs a directory of portal assets into the image format read by
+# src/asset_store.c. The image is flashed to its own data partition and
+# served straight from memory mapped flash.
+
+ASSET_STORE_MAGIC = 0x53414357  # "WCAS"
+ASSET_STORE_VERSION = 1
+
+HEADER = struct.Struct('<IHHI')
+ENTRY = struct.Struct('<IIIIIHH')
+
+
+def align(n, alignment=4):
+    return (n + alignment - 1) & ~(alignment - 1)
+
+
+def collect_assets(root):
+    assets = []
+    for dirpath, _, filenames in os.walk(root):
+        for filename in filenames:
+            full_path = os.path.join(dirpath, filename)
+            url_path = '/' + os.path.relpath(full_path, root).replace(os.sep, '/')
+            content_type, _ = mimetypes.guess_type(filename)
+            if content_type is None:
+                content_type = 'application/octet-stream'
+            elif content_type.startswith('text/') or content_type in (
+                    'application/javascript', 'application/json', 'image/svg+xml'):
+                content_type += '; charset=utf-8'
+            with open(full_path, 'rb') as f:
+                data = f.read()
+            assets.append((url_path.encode('utf-8'), content_type.encode('ascii'), data))
+
+    # The firmware looks assets up with a binary search
+    assets.sort(key=lambda asset: asset[0])
+    return assets
+
+
+def build_image(assets):
+    strings = bytearray()
+    string_base = HEADER.size + ENTRY.size * len(assets)
+
+    def add_string(s):
+        offset = string_base + len(strings)
+        strings.extend(s)
+        return offset
+
+    string_offsets = [(add_string(path), add_string(content_type))
+                      for path, content_type, _ in assets]
+
+    data = bytearray()
+    data_base = align(string_base + len(strings))
+
+    entries = bytearray()
+    for (path, content_type, content), (path_offset, type_offset) in zip(assets, string_offsets):
+        data_offset = data_base + len(data)
+        data.extend(content)
+        data.extend(b'\0' * (align(len(data)) - len(data)))
+        entries.extend(ENTRY.pack(
+            path_offset, type_offset, data_offset, len(content),
+            zlib.crc32(content) & 0xFFFFFFFF, len(path), len(content_type)))
+
+    size = data_base + len(data)
+    image = bytearray(HEADER.pack(ASSET_STORE_MAGIC, ASSET_STORE_VERSION, len(assets), size))
+    image.extend(entries)
+    image.extend(strings)
+    image.extend(b'\0' * (data_base - len(image)))
+    image.extend(data)
+    return bytes(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a portal asset image')
+    parser.add_argument('input_dir', help='directory with the assets to pack')
+    parser.add_argument('output', help='image file to write')
+    parser.add_argument('--partition-size', type=lambda s: int(s, 0),
+                        help='fail if the image does not fit a partition of this size')
+    args = parser.parse_args()
+
+    assets = collect_assets(args.input_dir)
+    image = build_image(assets)
+
+    if args.partition_size is not None and len(image) > args.partition_size:
+        raise SystemExit(f"❌ Image is {len(image)} bytes, partition holds {args.partition_size}")
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+
+    for path, content_type, content in assets:
+        print(f"  {path.decode('utf-8')} ({content_type.decode('ascii')}, {len(content)} bytes)")
+    print(f"✅ Generated: {args.output} ({len(image)} bytes, {len(assets)} assets)")
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,193 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import statistics
+import threading
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+# Provisions many devices concurrently through POST /provision and reports
+# per-device latency. Targets are portal addresses (host or host:port) on
+# the command line or in a file, one per line. --simulate starts in-process
+# portals that follow the firmware's /provision and /status contract, to
+# benchmark a provisioning pipeline without hardware.
+
+
+def provision(target, form, timeout, wait_status):
+    base = target if target.startswith('http') else f'http://{target}'
+    body = urllib.parse.urlencode(form).encode('ascii')
+
+    started = time.monotonic()
+    try:
+        request = urllib.request.Request(f'{base}/provision', data=body, method='POST')
+        with urllib.request.urlopen(request, timeout=timeout) as response:
+            response.read()
+            status = response.status
+    except urllib.error.HTTPError as e:
+        status = e.code
+    except OSError as e:
+        return {'target': target, 'ok': False, 'error': str(e),
+                'latency_ms': (time.monotonic() - started) * 1000}
+
+    result = {'target': target, 'ok': status == 202, 'status': status,
+              'latency_ms': (time.monotonic() - started) * 1000}
+    if not result['ok'] or not wait_status:
+        return result
+
+    # Follow the trial connect until the device reports the outcome
+    deadline = started + timeout
+    state = 'connecting'
+    while time.monotonic() < deadline:
+        try:
+            with urllib.request.urlopen(f'{base}/status', timeout=timeout) as response:
+                state = json.loads(response.read()).get('state', 'unknown')
+        except OSError:
+            # The portal goes away once the device joins the network
+            state = 'gone'
+        if state not in ('idle', 'connecting'):
+            break
+        time.sleep(0.2)
+
+    result['state'] = state
+    result['ok'] = state in ('connected', 'gone')
+    result['connected_ms'] = (time.monotonic() - started) * 1000
+    return result
+
+
+class SimulatedPortal(BaseHTTPRequestHandler):
+    latency = 0.0
+    connect_time = 0.0
+
+    def log_message(self, format, *args):
+        pass
+
+    def reply(self, code, body, content_type='text/plain'):
+        self.send_response(code)
+        self.send_header('Content-Type', content_type)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_POST(self):
+        length = int(self.headers.get('Content-Length', 0))
+        form = urllib.parse.parse_qs(self.rfile.read(length).decode('utf-8'))
+        time.sleep(self.latency)
+
+        if self.path != '/provision':
+            return self.reply(404, b'')
+        ssid = form.get('ssid', [''])[0]
+        if not ssid or len(ssid) > 32:
+            return self.reply(400, b'ERR\n')
+
+        self.server.provisioned_at = time.monotonic()
+        self.server.failed = ssid == 'fail' and form.get('commit', [''])[0] != '1'
+        self.reply(202, b'OK\n')
+
+    def do_GET(self):
+        if self.path != '/status':
+            return self.reply(404, b'')
+
+        provisioned_at = getattr(self.server, 'provisioned_at', None)
+        if provisioned_at is None:
+            state = 'idle'
+        elif time.monotonic() - provisioned_at < self.connect_time:
+            state = 'connecting'
+        else:
+            state = 'failed' if self.server.failed else 'connected'
+        body = json.dumps({'state': state, 'reason': 202 if state == 'failed' else 0})
+        self.reply(200, body.encode('ascii'), 'application/json')
+
+
+def start_simulated_portals(count, latency_ms, connect_ms):
+    SimulatedPortal.latency = latency_ms / 1000
+    SimulatedPortal.connect_time = connect_ms / 1000
+
+    servers = []
+    for _ in range(count):
+        server = ThreadingHTTPServer(('127.0.0.1', 0), SimulatedPortal)
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+        servers.append(server)
+    return servers, [f'127.0.0.1:{server.server_address[1]}' for server in servers]
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(round(p / 100 * (len(values) - 1))))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Provision a fleet of devices through POST /provision')
+    parser.add_argument('targets', nargs='*', help='portal addresses, e.g. 192.168.4.1 or 10.0.0.7:8080')
+    parser.add_argument('--targets-file', help='file with one portal address per line')
+    parser.add_argument('--ssid', required=True)
+    parser.add_argument('--password', default='')
+    parser.add_argument('--extra', action='append', default=[], metavar='KEY=VALUE',
+                        help='extra key stored on the device, may be repeated')
+    parser.add_argument('--commit', action='store_true',
+                        help='save the credentials without a trial connect')
+    parser.add_argument('--wait-status', action='store_true',
+                        help='poll /status until each device reports the connect outcome')
+    parser.add_argument('--concurrency', type=int, default=32)
+    parser.add_argument('--timeout', type=float, default=30.0, help='seconds per device')
+    parser.add_argument('--simulate', type=int, metavar='N',
+                        help='provision N simulated portals instead of real devices')
+    parser.add_argument('--sim-latency', type=float, default=20.0, help='simulated request latency in ms')
+    parser.add_argument('--sim-connect', type=float, default=1000.0, help='simulated trial connect time in ms')
+    args = parser.parse_args()
+
+    form = {'ssid': args.ssid}
+    if args.password:
+        form['password'] = args.password
+    if args.commit:
+        form['commit'] = '1'
+    for extra in args.extra:
+        key, _, value = extra.partition('=')
+        form[key] = value
+
+    targets = list(args.targets)
+    if args.targets_file:
+        with open(args.targets_file) as f:
+            targets += [line.strip() for line in f if line.strip() and not line.startswith('#')]
+
+    servers = []
+    if args.simulate:
+        servers, targets = start_simulated_portals(args.simulate, args.sim_latency, args.sim_connect)
+    if not targets:
+        raise SystemExit("❌ No targets given")
+
+    started = time.monotonic()
+    with ThreadPoolExecutor(max_workers=args.concurrency) as executor:
+        results = list(executor.map(
+            lambda target: provision(target, form, args.timeout, args.wait_status), targets))
+    elapsed = time.monotonic() - started
+
+    for server in servers:
+        server.shutdown()
+
+    for result in results:
+        line = f"  {'✅' if result['ok'] else '❌'} {result['target']:<24} {result['latency_ms']:8.1f} ms"
+        if 'connected_ms' in result:
+            line += f"  {result['state']} after {result['connected_ms']:.0f} ms"
+        if 'error' in result:
+            line += f"  {result['error']}"
+        elif not result['ok'] and 'state' not in result:
+            line += f"  HTTP {result['status']}"
+        print(line)
+
+    latencies = [result['latency_ms'] for result in results]
+    succeeded = sum(result['ok'] for result in results)
+    print(f"{succeeded}/{len(results)} provisioned in {elapsed:.2f} s "
+          f"({len(results) / elapsed:.1f} devices/s), request latency "
+          f"p50 {statistics.median(latencies):.1f} ms, p95 {percentile(latencies, 95):.1f} ms, "
+          f"max {max(latencies):.1f} ms")
+
+    if succeeded != len(results):
+        raise SystemExit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,61 +1,164 @@
-
 #!/usr/bin/env python3
 import os
 import re
 
-# Mapping van part tags naar variabelenamen in C
-PARTS = {
-    "HTML_SETTINGS_HEADER": "html_settings_header",
-    "HTML_SETTINGS_CUSTOM_HTML": "html_settings_custom_html",
-    "HTML_SETTINGS_BODY": "html_settings_body",
-    "HTML_NETWORK_ITEM": "html_network_item",
-    "HTML_SETTINGS_FOOTER": "html_settings_footer"
-}
+# Compiles the Jinja2 template in content/index.html into a table of
+# template_op_t opcodes (see src/template.h) that the firmware walks at runtime.
+#
+# Supported syntax:
+#   {{ name }}, {{ item.field }}        value slot, HTML-escaped
+#   {{ name|safe }}                     value slot, written as is
+#   {{ item.field | ternary('a', 'b') }} expanded into an if/else on the slot
+#   {% if name %} / {% else %} / {% endif %}
+#   {% for item in items %} / {% endfor %}
+#
+# Slot and list names are turned into TEMPLATE_VALUE_* / TEMPLATE_LIST_*
+# identifiers, which the firmware binds to data.
 
+TEMPLATE_NAME = "html_settings_template"
+
+MAX_TEXT_LENGTH = 0xFFFF
+
+TOKEN_RE = re.compile(r'({{.*?}}|{%.*?%})')
+PART_RE = re.compile(r'<!--\s*part\s+\w+\s*-->')
+TERNARY_RE = re.compile(
+    r"^ternary\(\s*'([^']*)'\s*,\s*'([^']*)'\s*\)$")
 
-def escape_c_string(s):
-    return s.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n"\n"')
-
-
-def extract_parts(html):
-    # Verwijder Jinja2 {% ... %} tags
-    html = re.sub(r'{%.*?%}', '', html, flags=re.DOTALL)
-    # Vervang Jinja2 {{ ... }} met %s
-    html = re.sub(r'{{.*?}}', '%s', html)
-
-    result = {}
-    current_part = None
-    buffer = []
-
-    for line in html.splitlines():
-        match = re.match(r'<!--\s*part\s+(\w+)\s*-->', line.strip())
-        if match:
-            if current_part and current_part in PARTS:
-                result[PARTS[current_part]] = '\n'.join(buffer).strip()
-            current_part = match.group(1)
-            buffer = []
-        else:
-            buffer.append(line)
 
-    if current_part and current_part in PARTS:
-        result[PARTS[current_part]] = '\n'.join(buffer).strip()
+def escape_c_string(s):
+    return s.replace('\\', '\\\\').replace('"', '\\"')
 
-    return result
 
+def slot_name(expression, loop_vars):
+    parts = expression.strip().split('.')
+    if len(parts) > 2 or not all(re.match(r'^\w+$', p) for p in parts):
+        raise ValueError(f"Unsupported expression: {expression}")
+    return 'TEMPLATE_VALUE_' + '_'.join(parts).upper()
 
-def generate_c_output(parts):
-    output = ["// Auto-generated from index.html\n"]
 
-    for part_key in PARTS:
-        name = PARTS[part_key]
-        content = parts.get(name, "")
+class Compiler:
+    def __init__(self):
+        self.ops = []
+        self.blocks = []
+        self.loop_vars = []
 
-        lines = content.splitlines()
-        processed_lines = [
-            '"' + line.lstrip().replace('"', '\\"') + '"' for line in lines if line.strip()]
-        output.append(f'const char *{name} = \n' +
-                      '\n'.join(processed_lines) + ';\n')
+    def emit(self, op):
+        self.ops.append(op)
+        return len(self.ops) - 1
 
+    def text(self, s):
+        if not s:
+            return
+        last = self.ops[-1] if self.ops else None
+        if last and last['type'] == 'TEXT' and \
+                last['length'] + len(s.encode('utf-8')) <= MAX_TEXT_LENGTH:
+            last['pieces'].append(s)
+            last['length'] += len(s.encode('utf-8'))
+        else:
+            self.emit({'type': 'TEXT', 'pieces': [s],
+                       'length': len(s.encode('utf-8'))})
+
+    def open_block(self, kind, op):
+        index = self.emit(op)
+        self.blocks.append((kind, index))
+
+    def close_block(self, kind):
+        if not self.blocks or self.blocks[-1][0] != kind:
+            raise ValueError(f"Unexpected end of {kind} block")
+        _, index = self.blocks.pop()
+        return index
+
+    def output(self, expression):
+        expression, *filters = [f.strip() for f in expression.split('|')]
+        slot = slot_name(expression, self.loop_vars)
+
+        if not filters:
+            self.emit({'type': 'VALUE', 'arg': slot})
+        elif filters == ['safe']:
+            self.emit({'type': 'VALUE_RAW', 'arg': slot})
+        elif len(filters) == 1 and TERNARY_RE.match(filters[0]):
+            when_true, when_false = TERNARY_RE.match(filters[0]).groups()
+            self.statement(f'if {expression}')
+            self.text(when_true)
+            self.statement('else')
+            self.text(when_false)
+            self.statement('endif')
+        else:
+            raise ValueError(f"Unsupported filters: {filters}")
+
+    def statement(self, statement):
+        words = statement.split()
+        if words[0] == 'if' and len(words) == 2:
+            self.open_block('if', {'type': 'IF', 'arg': slot_name(
+                words[1], self.loop_vars)})
+        elif words == ['else']:
+            index = self.close_block('if')
+            self.ops[index]['jump'] = len(self.ops)
+            self.open_block('if', {'type': 'ELSE'})
+        elif words == ['endif']:
+            index = self.close_block('if')
+            self.ops[index]['jump'] = self.emit({'type': 'END_IF'})
+        elif words[0] == 'for' and len(words) == 4 and words[2] == 'in':
+            self.loop_vars.append(words[1])
+            self.open_block('for', {
+                'type': 'FOR', 'arg': 'TEMPLATE_LIST_' + words[3].upper()})
+        elif words == ['endfor']:
+            self.loop_vars.pop()
+            index = self.close_block('for')
+            self.ops[index]['jump'] = self.emit(
+                {'type': 'END_FOR', 'jump': index})
+        else:
+            raise ValueError(f"Unsupported statement: {statement}")
+
+    def compile(self, html):
+        html = PART_RE.sub('', html)
+
+        for line in html.splitlines():
+            line = line.lstrip()
+            if not line.strip():
+                continue
+
+            for token in TOKEN_RE.split(line):
+                if token.startswith('{{'):
+                    self.output(token[2:-2])
+                elif token.startswith('{%'):
+                    self.statement(token[2:-2].strip())
+                else:
+                    self.text(token)
+
+        if self.blocks:
+            raise ValueError(f"Unclosed {self.blocks[-1][0]} block")
+
+        self.emit({'type': 'END'})
+        return self.ops
+
+
+def generate_c_output(ops):
+    output = [
+        "// Auto-generated from index.html by tools/generate_index_html_header.py",
+        "",
+        "#pragma once",
+        "",
+        '#include "template.h"',
+        "",
+        f"static const template_op_t {TEMPLATE_NAME}[] = {{",
+    ]
+
+    for index, op in enumerate(ops):
+        fields = [f".type = TEMPLATE_OP_{op['type']}"]
+        if 'arg' in op:
+            fields.append(f".arg = {op['arg']}")
+        if 'jump' in op:
+            fields.append(f".jump = {op['jump']}")
+        if op['type'] == 'TEXT':
+            fields.append(f".length = {op['length']}")
+            text = '\n                  '.join(
+                '"' + escape_c_string(p) + '"' for p in op['pieces'])
+            fields.append(f".text = {text}")
+        output.append(f"        /* {index} */ {{ " + ", ".join(fields) + " },")
+
+    output.append("};")
+    output.append("")
     return '\n'.join(output)
 
 
@@ -79,8 +182,8 @@ def main():
     with open(input_file, 'r', encoding='utf-8') as f:
         html = f.read()
 
-    parts = extract_parts(html)
-    c_output = generate_c_output(parts)
+    ops = Compiler().compile(html)
+    c_output = generate_c_output(ops)
 
     with open(output_file, 'w', encoding='utf-8') as f:
         f.write(c_output)
@@ -0,0 +1,118 @@
+/*
+ * Runs the firmware's liveness schedule (src/liveness.c) and probe
+ * (src/liveness_probe.c) on the host against a stand-in gateway, in real
+ * time, and reports how long a wedged gateway took to be declared dead
+ * against the configured worst case.
+ *
+ *   cc -O2 -Isrc -o liveness_check tools/liveness_check.c src/liveness.c src/liveness_probe.c
+ *   python3 tools/liveness_gateway.py --port 5353 --wedge-after 10 &
+ *   ./liveness_check 127.0.0.1 5353 --detect 4000 --budget 30
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "liveness.h"
+#include "liveness_probe.h"
+
+
+static uint64_t now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sleep_ms(uint32_t ms) {
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        nanosleep(&ts, NULL);
+}
+
+
+int main(int argc, char **argv) {
+        if (argc < 3) {
+                fprintf(stderr, "usage: %s address port [--detect ms] [--budget probes/min] "
+                        "[--timeout ms] [--misses n] [--duration ms] [--expect-alive 1]\n", argv[0]);
+                return 2;
+        }
+
+        uint32_t address = inet_addr(argv[1]);
+        uint16_t port = atoi(argv[2]);
+        uint32_t detect = 20000, budget = 2, timeout = 1000, misses = 3, duration = 120000, expect_alive = 0;
+        for (int i = 3; i + 1 < argc; i += 2) {
+                uint32_t value = strtoul(argv[i + 1], NULL, 0);
+                if (!strcmp(argv[i], "--detect"))
+                        detect = value;
+                else if (!strcmp(argv[i], "--budget"))
+                        budget = value;
+                else if (!strcmp(argv[i], "--timeout"))
+                        timeout = value;
+                else if (!strcmp(argv[i], "--misses"))
+                        misses = value;
+                else if (!strcmp(argv[i], "--duration"))
+                        duration = value;
+                else if (!strcmp(argv[i], "--expect-alive"))
+                        expect_alive = value;
+        }
+
+        liveness_config_t config;
+        liveness_config_init(&config, detect, budget, timeout, misses);
+        printf("interval %u ms, retry %u ms, timeout %u ms, %u misses: worst case %u ms\n",
+               (unsigned) config.interval, (unsigned) config.retry_interval, (unsigned) config.timeout,
+               (unsigned) config.max_misses, (unsigned) liveness_detect_time(&config));
+
+        int fd = liveness_probe_open();
+        if (fd < 0) {
+                perror("socket");
+                return 1;
+        }
+
+        liveness_state_t state;
+        liveness_reset(&state);
+
+        uint64_t started = now_ms();
+        uint64_t last_answer = 0;
+        unsigned probes = 0;
+        uint16_t id = 0;
+        // With --expect-alive the run passes if the link is never declared dead
+        int result = expect_alive ? 0 : 1;
+
+        while (now_ms() - started < duration) {
+                id++;
+                uint64_t sent = now_ms();
+                liveness_probe_send(fd, address, port, id);
+                probes++;
+
+                sleep_ms(config.timeout);
+                bool answered = liveness_probe_answered(fd, id);
+                if (answered)
+                        last_answer = sent;
+
+                uint32_t next = 0;
+                liveness_verdict_t verdict = liveness_on_result(&state, &config, answered, &next);
+                printf("%7.2fs probe %u %s\n", (sent - started) / 1000.0, (unsigned) id,
+                       answered ? "answered" : "missed");
+
+                if (verdict == LIVENESS_UNSUPPORTED) {
+                        printf("Gateway never answered, probing stopped\n");
+                        result = 1;
+                        break;
+                }
+                if (verdict == LIVENESS_DEAD) {
+                        uint64_t detected = now_ms();
+                        printf("Dead after %u ms since the last answered probe (worst case %u ms), "
+                               "%u probes sent\n", (unsigned) (detected - last_answer),
+                               (unsigned) liveness_detect_time(&config), probes);
+                        result = !expect_alive && detected - last_answer <= liveness_detect_time(&config) + 100 ?
+                                 0 : 1;
+                        break;
+                }
+
+                sleep_ms(next);
+        }
+
+        liveness_probe_close(fd);
+        return result;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+import argparse
+import socket
+import struct
+import time
+
+# Stand-in gateway for exercising the liveness probe on the host. The probe
+# is an ICMP echo, which the host build sends over UDP so no privileges are
+# needed; this answers it with an echo reply, as a router's own stack
+# would. It can be made to wedge (stop answering) and recover on a
+# schedule, or to lose its uplink: recursive DNS through its forwarder then
+# goes unanswered while the router itself, and so the probe, still works.
+
+ICMP_ECHO_REPLY = 0
+ICMP_ECHO_REQUEST = 8
+DNS_FLAG_RD = 0x0100
+
+
+def checksum(data):
+    if len(data) % 2:
+        data += b'\0'
+    total = sum(struct.unpack(f'!{len(data) // 2}H', data))
+    while total >> 16:
+        total = (total & 0xffff) + (total >> 16)
+    return ~total & 0xffff
+
+
+def echo_reply(request):
+    reply = bytes([ICMP_ECHO_REPLY, 0, 0, 0]) + request[4:]
+    return reply[:2] + struct.pack('!H', checksum(reply)) + reply[4:]
+
+
+def dns_refused(query):
+    query_id, flags = struct.unpack('!HH', query[:4])
+    # Response, same opcode and RD, recursion available, REFUSED
+    reply_flags = 0x8000 | (flags & 0x7900) | 0x0080 | 5
+    return struct.pack('!HH', query_id, reply_flags) + query[4:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Stand-in gateway answering liveness probes')
+    parser.add_argument('--bind', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=5353)
+    parser.add_argument('--wedge-after', type=float, help='stop answering after this many seconds')
+    parser.add_argument('--recover-after', type=float, help='answer again after this many seconds')
+    parser.add_argument('--wan-down-after', type=float,
+                        help='lose the uplink after this many seconds: recursive DNS queries '
+                             'go unanswered, the router itself keeps answering')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind((args.bind, args.port))
+    sock.settimeout(0.1)
+    print(f'Gateway on {args.bind}:{args.port}', flush=True)
+
+    started = time.monotonic()
+    wedged = False
+    wan_down = False
+    while True:
+        elapsed = time.monotonic() - started
+        should_wedge = (args.wedge_after is not None and elapsed >= args.wedge_after and
+                        (args.recover_after is None or elapsed < args.recover_after))
+        if should_wedge != wedged:
+            wedged = should_wedge
+            print(f'{elapsed:7.2f}s {"wedged" if wedged else "recovered"}', flush=True)
+        if not wan_down and args.wan_down_after is not None and elapsed >= args.wan_down_after:
+            wan_down = True
+            print(f'{elapsed:7.2f}s uplink down, LAN still up', flush=True)
+
+        try:
+            packet, peer = sock.recvfrom(512)
+        except socket.timeout:
+            continue
+        if wedged:
+            continue
+
+        if len(packet) >= 8 and packet[0] == ICMP_ECHO_REQUEST:
+            sock.sendto(echo_reply(packet), peer)
+        elif len(packet) >= 12:
+            # Anything else is taken for DNS. A forwarder without uplink
+            # can only answer what it doesn't have to forward.
+            flags = struct.unpack('!H', packet[2:4])[0]
+            if wan_down and flags & DNS_FLAG_RD:
+                continue
+            sock.sendto(dns_refused(packet), peer)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+import argparse
+import hashlib
+import json
+import sys
+import time
+import urllib.error
+import urllib.request
+
+# Uploads a firmware image to a portal's POST /ota and reports throughput.
+# The image is streamed in chunks, so the sender feels the device's
+# back-pressure; the device's own timing and peak heap use come back in
+# the response.
+
+
+def chunks(path, size):
+    with open(path, 'rb') as f:
+        while True:
+            chunk = f.read(size)
+            if not chunk:
+                return
+            yield chunk
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Upload firmware through the wifi_config portal')
+    parser.add_argument('image', help='firmware binary')
+    parser.add_argument('--host', default='192.168.4.1', help='portal address (default 192.168.4.1)')
+    parser.add_argument('--chunk', type=int, default=4096, help='sender chunk size in bytes')
+    parser.add_argument('--timeout', type=float, default=60.0)
+    parser.add_argument('--no-verify', action='store_true', help="don't send the image digest")
+    parser.add_argument('--token', help='upload token the firmware was built with (WIFI_CONFIG_OTA_TOKEN)')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        digest = hashlib.sha256(f.read()).hexdigest()
+        size = f.tell()
+
+    base = args.host if args.host.startswith('http') else f'http://{args.host}'
+    url = f'{base}/ota' if args.no_verify else f'{base}/ota?sha256={digest}'
+
+    headers = {'Content-Type': 'application/octet-stream', 'Content-Length': str(size)}
+    if args.token:
+        headers['Authorization'] = f'Bearer {args.token}'
+    request = urllib.request.Request(url, data=chunks(args.image, args.chunk), method='POST',
+                                     headers=headers)
+
+    started = time.monotonic()
+    try:
+        with urllib.request.urlopen(request, timeout=args.timeout) as response:
+            result = json.loads(response.read())
+    except urllib.error.HTTPError as e:
+        if e.code == 401:
+            print('Upload rejected: missing or wrong --token', file=sys.stderr)
+        else:
+            print(f'Upload rejected: HTTP {e.code}', file=sys.stderr)
+        return 1
+    except OSError as e:
+        print(f'Upload failed: {e}', file=sys.stderr)
+        return 1
+    elapsed = time.monotonic() - started
+
+    print(f'Sent {size} bytes in {elapsed:.2f} s ({size / elapsed / 1024:.1f} kB/s)')
+    print(f'Device: {result["size"]} bytes in {result["ms"]} ms, '
+          f'peak heap {result["peak_heap"]} bytes')
+    if result['sha256'] != digest:
+        print(f'Digest mismatch: device {result["sha256"]}, image {digest}', file=sys.stderr)
+        return 1
+    print(f'SHA-256 {digest} verified, device is restarting')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
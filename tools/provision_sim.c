@@ -0,0 +1,510 @@
+/*
+ * Virtual-time simulator for the provisioning logic in src/provision_fsm.c.
+ *
+ * The firmware glue of wifi_config.c (monitor timer, connect timer, SoftAP
+ * start/stop, portal scans holding the radio) is mirrored here around the
+ * real state logic, and a scripted WiFi driver plays the network: the
+ * access point is missing for a while after boot and may flap, handshakes
+ * fail now and then and DHCP is sometimes slow. Every scenario is seeded
+ * from its index, so all policies see the same scenarios.
+ *
+ * Build and run on the host:
+ *
+ *   cc -O2 -Isrc -o provision_sim tools/provision_sim.c src/provision_fsm.c
+ *   ./provision_sim -n 20000 --policy 2000:120000:10000 --policy 1000:30000:5000:0
+ *
+ * A policy is backoff_min:backoff_max:disconnected_monitor_interval[:grace]
+ * in ms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "provision_fsm.h"
+
+#define MAX_POLICIES 8
+#define MAX_TOGGLES 8
+
+// Firmware constants the glue depends on, see wifi_config.c
+#define CONNECT_ATTEMPT_TIME 5000
+#define CONNECTED_MONITOR_INTERVAL 30000
+#define PRESCAN_TIME 600
+#define SCAN_TIME 1500
+#define SCAN_INTERVAL 10000
+#define PORTAL_GRACE 30000
+#define PORTAL_GRACE_MAX 240000
+#define STABLE_TIME 600000
+
+// Driver timing
+#define NO_AP_FAIL_TIME 2500
+
+
+typedef struct {
+        int scenarios;
+        uint64_t seed;
+        uint32_t outage_max;        // AP missing for up to this long after boot
+        double flap;                // chance the AP drops again after coming up
+        double auth_fail;           // chance a handshake fails with the AP up
+        double slow_dhcp;           // chance DHCP takes seconds instead of ms
+        double phone;               // chance a phone sits on the portal, scanning
+        uint32_t horizon;
+} sim_params_t;
+
+
+typedef enum {
+        TIMER_MONITOR = 0,
+        TIMER_CONNECT,
+        TIMER_ASSOC,
+        TIMER_DHCP,
+        TIMER_AP,
+        TIMER_SCAN,
+        TIMER_COUNT,
+} sim_timer_t;
+
+
+typedef struct {
+        const sim_params_t *params;
+        const provision_config_t *policy;
+        uint64_t rng;
+
+        uint64_t now;
+        uint64_t due[TIMER_COUNT];
+        bool armed[TIMER_COUNT];
+
+        // Network script
+        uint64_t toggles[MAX_TOGGLES];
+        int toggle_count;
+        int next_toggle;
+        uint64_t final_up;
+        bool phone;
+
+        // Driver
+        bool ap_up;
+        bool associating;
+        bool assoc_ok;
+        bool associated;
+        bool got_ip;
+
+        // Firmware
+        provision_state_t fsm;
+        bool portal_up;
+        bool scanning;
+        bool sta_connecting;
+        uint64_t sta_connect_started;
+
+        // Results
+        unsigned attempts;
+        unsigned interrupted;
+        unsigned deferred;
+        unsigned portal_starts;
+        uint64_t portal_time;
+        uint64_t portal_since;
+} sim_t;
+
+
+static uint64_t rng_next(uint64_t *state) {
+        // splitmix64
+        uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+}
+
+static double rng_unit(uint64_t *state) {
+        return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint32_t rng_range(uint64_t *state, uint32_t low, uint32_t high) {
+        return low + (uint32_t) (rng_unit(state) * (high - low + 1));
+}
+
+
+static void timer_arm(sim_t *sim, sim_timer_t timer, uint64_t delay) {
+        sim->armed[timer] = true;
+        sim->due[timer] = sim->now + delay;
+}
+
+static void timer_disarm(sim_t *sim, sim_timer_t timer) {
+        sim->armed[timer] = false;
+}
+
+
+// Driver
+
+static void driver_disconnected(sim_t *sim) {
+        sim->associated = false;
+        sim->got_ip = false;
+        sim->sta_connecting = false;
+        timer_disarm(sim, TIMER_DHCP);
+}
+
+static void driver_connect(sim_t *sim) {
+        // A new connect aborts the attempt in flight
+        if (sim->associating || (sim->associated && !sim->got_ip))
+                sim->interrupted++;
+        driver_disconnected(sim);
+
+        sim->associating = true;
+        sim->sta_connecting = true;
+        sim->sta_connect_started = sim->now;
+
+        if (!sim->ap_up) {
+                sim->assoc_ok = false;
+                timer_arm(sim, TIMER_ASSOC, NO_AP_FAIL_TIME);
+        } else if (rng_unit(&sim->rng) < sim->params->auth_fail) {
+                sim->assoc_ok = false;
+                timer_arm(sim, TIMER_ASSOC, rng_range(&sim->rng, 800, 1500));
+        } else {
+                sim->assoc_ok = true;
+                timer_arm(sim, TIMER_ASSOC, rng_range(&sim->rng, 300, 1500));
+        }
+}
+
+static void driver_on_assoc(sim_t *sim) {
+        sim->associating = false;
+        if (!sim->assoc_ok || !sim->ap_up) {
+                driver_disconnected(sim);
+                return;
+        }
+
+        sim->associated = true;
+        bool slow = rng_unit(&sim->rng) < sim->params->slow_dhcp;
+        timer_arm(sim, TIMER_DHCP, slow ? rng_range(&sim->rng, 3000, 8000) : rng_range(&sim->rng, 50, 400));
+}
+
+static void driver_on_dhcp(sim_t *sim) {
+        sim->got_ip = true;
+        sim->sta_connecting = false;
+}
+
+static void driver_on_ap_toggle(sim_t *sim) {
+        sim->ap_up = !sim->ap_up;
+        if (!sim->ap_up && (sim->associated || sim->associating)) {
+                sim->associating = false;
+                timer_disarm(sim, TIMER_ASSOC);
+                driver_disconnected(sim);
+        }
+
+        if (++sim->next_toggle < sim->toggle_count)
+                sim->due[TIMER_AP] = sim->toggles[sim->next_toggle];
+        else
+                timer_disarm(sim, TIMER_AP);
+}
+
+
+// Firmware glue, mirroring wifi_config.c
+
+static void portal_scan_schedule(sim_t *sim, uint64_t delay) {
+        if (sim->portal_up && sim->phone)
+                timer_arm(sim, TIMER_SCAN, delay);
+        else
+                timer_disarm(sim, TIMER_SCAN);
+}
+
+static void firmware_on_scan(sim_t *sim) {
+        if (sim->scanning) {
+                sim->scanning = false;
+                portal_scan_schedule(sim, SCAN_INTERVAL);
+                return;
+        }
+
+        // The scan task leaves the radio to a running connect attempt
+        if (sim->sta_connecting && sim->now - sim->sta_connect_started < CONNECT_ATTEMPT_TIME) {
+                portal_scan_schedule(sim, 1000);
+                return;
+        }
+
+        sim->scanning = true;
+        timer_arm(sim, TIMER_SCAN, SCAN_TIME);
+}
+
+static void firmware_softap_start(sim_t *sim) {
+        sim->portal_up = true;
+        sim->portal_since = sim->now;
+        sim->portal_starts++;
+
+        // Station mode pre-scan, skipped while a connect attempt runs
+        if (!sim->sta_connecting) {
+                sim->scanning = true;
+                timer_arm(sim, TIMER_SCAN, PRESCAN_TIME);
+        }
+}
+
+static void firmware_softap_stop(sim_t *sim) {
+        if (sim->portal_up)
+                sim->portal_time += sim->now - sim->portal_since;
+        sim->portal_up = false;
+        sim->scanning = false;
+        timer_disarm(sim, TIMER_SCAN);
+}
+
+static void firmware_on_monitor(sim_t *sim) {
+        provision_inputs_t inputs = {
+                .got_ip = sim->got_ip,
+                .portal_up = sim->portal_up,
+                .has_config = true,
+                .now = sim->now,
+        };
+        uint32_t actions = provision_monitor(&sim->fsm, sim->policy, &inputs);
+
+        if (actions & (PROVISION_CONNECTED | PROVISION_RESUMED))
+                timer_disarm(sim, TIMER_CONNECT);
+        if ((actions & PROVISION_SCHEDULE_CONNECT) && !sim->armed[TIMER_CONNECT])
+                timer_arm(sim, TIMER_CONNECT, 0);
+        if (actions & PROVISION_SOFTAP_STOP)
+                firmware_softap_stop(sim);
+
+        timer_arm(sim, TIMER_MONITOR, sim->fsm.monitor_interval);
+
+        if (actions & PROVISION_SOFTAP_START)
+                firmware_softap_start(sim);
+}
+
+static void firmware_on_connect_timer(sim_t *sim) {
+        timer_disarm(sim, TIMER_CONNECT);
+
+        uint32_t delay = 0;
+        uint64_t elapsed = sim->now - sim->sta_connect_started;
+        uint32_t attempt_remaining = sim->sta_connecting && elapsed < CONNECT_ATTEMPT_TIME ?
+                                     CONNECT_ATTEMPT_TIME - elapsed : 0;
+        switch (provision_connect_due(sim->got_ip, attempt_remaining, false, sim->scanning, &delay)) {
+        case PROVISION_CONNECT_SKIP:
+                return;
+        case PROVISION_CONNECT_DEFER:
+                sim->deferred++;
+                timer_arm(sim, TIMER_CONNECT, delay);
+                return;
+        case PROVISION_CONNECT_ATTEMPT:
+                break;
+        }
+
+        sim->attempts++;
+        driver_connect(sim);
+
+        delay = provision_connect_started(&sim->fsm, sim->policy, (uint32_t) rng_next(&sim->rng));
+        timer_arm(sim, TIMER_CONNECT, delay);
+}
+
+
+// Runs one scenario, returns the time from the AP's final return to an IP
+// address, or -1 if the device was not connected by the horizon
+static int64_t sim_run(sim_t *sim, const sim_params_t *params, const provision_config_t *policy,
+                       uint64_t seed) {
+        memset(sim, 0, sizeof(*sim));
+        sim->params = params;
+        sim->policy = policy;
+        sim->rng = seed;
+
+        // Network script: down at boot, up after the outage, maybe a flap
+        sim->toggles[sim->toggle_count++] = rng_range(&sim->rng, 0, params->outage_max);
+        if (rng_unit(&sim->rng) < params->flap) {
+                uint64_t down = sim->toggles[0] + rng_range(&sim->rng, 5000, 60000);
+                sim->toggles[sim->toggle_count++] = down;
+                sim->toggles[sim->toggle_count++] = down + rng_range(&sim->rng, 10000, 60000);
+        }
+        sim->final_up = sim->toggles[sim->toggle_count - 1];
+        sim->due[TIMER_AP] = sim->toggles[0];
+        sim->armed[TIMER_AP] = true;
+        sim->phone = rng_unit(&sim->rng) < params->phone;
+
+        // wifi_config_start() with saved credentials
+        provision_init(&sim->fsm, policy, 0);
+        provision_backoff_reset(&sim->fsm, policy);
+        timer_arm(sim, TIMER_CONNECT, 0);
+        timer_arm(sim, TIMER_MONITOR, sim->fsm.monitor_interval);
+
+        while (true) {
+                if (sim->got_ip && sim->now >= sim->final_up && !sim->armed[TIMER_AP])
+                        return sim->now - sim->final_up;
+
+                int next = -1;
+                for (int i = 0; i < TIMER_COUNT; i++) {
+                        if (sim->armed[i] && (next < 0 || sim->due[i] < sim->due[next]))
+                                next = i;
+                }
+                if (next < 0 || sim->due[next] > params->horizon)
+                        return -1;
+
+                sim->now = sim->due[next];
+                switch ((sim_timer_t) next) {
+                case TIMER_MONITOR:
+                        firmware_on_monitor(sim);
+                        break;
+                case TIMER_CONNECT:
+                        firmware_on_connect_timer(sim);
+                        break;
+                case TIMER_ASSOC:
+                        timer_disarm(sim, TIMER_ASSOC);
+                        driver_on_assoc(sim);
+                        break;
+                case TIMER_DHCP:
+                        timer_disarm(sim, TIMER_DHCP);
+                        driver_on_dhcp(sim);
+                        break;
+                case TIMER_AP:
+                        driver_on_ap_toggle(sim);
+                        break;
+                case TIMER_SCAN:
+                        timer_disarm(sim, TIMER_SCAN);
+                        firmware_on_scan(sim);
+                        break;
+                case TIMER_COUNT:
+                        break;
+                }
+        }
+}
+
+
+static int compare_u32(const void *a, const void *b) {
+        uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+        return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *sorted, int count, double p) {
+        if (!count)
+                return 0;
+        int index = (int) (p * (count - 1) + 0.5);
+        return sorted[index];
+}
+
+
+static int parse_policy(const char *text, provision_config_t *policy) {
+        unsigned min, max, interval, grace = PORTAL_GRACE;
+        int fields = sscanf(text, "%u:%u:%u:%u", &min, &max, &interval, &grace);
+        if (fields < 3 || !min || max < min || !interval)
+                return -1;
+
+        policy->backoff_min = min;
+        policy->backoff_max = max;
+        policy->connected_interval = CONNECTED_MONITOR_INTERVAL;
+        policy->disconnected_interval = interval;
+        policy->grace = grace;
+        policy->grace_max = grace > PORTAL_GRACE_MAX ? grace : PORTAL_GRACE_MAX;
+        policy->stable_time = STABLE_TIME;
+        return 0;
+}
+
+
+static void usage(const char *name) {
+        fprintf(stderr,
+                "usage: %s [-n scenarios] [--seed N] [--outage-max ms] [--flap p] [--auth-fail p]\n"
+                "          [--slow-dhcp p] [--phone p] [--horizon ms] [--policy min:max:interval[:grace]]...\n",
+                name);
+}
+
+
+int main(int argc, char **argv) {
+        sim_params_t params = {
+                .scenarios = 10000,
+                .seed = 1,
+                .outage_max = 300000,
+                .flap = 0.2,
+                .auth_fail = 0.1,
+                .slow_dhcp = 0.2,
+                .phone = 0.1,
+                .horizon = 3600000,
+        };
+
+        provision_config_t policies[MAX_POLICIES];
+        int policy_count = 0;
+
+        for (int i = 1; i < argc; i++) {
+                const char *arg = argv[i];
+                const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+                if (!value) {
+                        usage(argv[0]);
+                        return 2;
+                }
+                i++;
+
+                if (!strcmp(arg, "-n")) {
+                        params.scenarios = atoi(value);
+                } else if (!strcmp(arg, "--seed")) {
+                        params.seed = strtoull(value, NULL, 0);
+                } else if (!strcmp(arg, "--outage-max")) {
+                        params.outage_max = strtoul(value, NULL, 0);
+                } else if (!strcmp(arg, "--flap")) {
+                        params.flap = atof(value);
+                } else if (!strcmp(arg, "--auth-fail")) {
+                        params.auth_fail = atof(value);
+                } else if (!strcmp(arg, "--slow-dhcp")) {
+                        params.slow_dhcp = atof(value);
+                } else if (!strcmp(arg, "--phone")) {
+                        params.phone = atof(value);
+                } else if (!strcmp(arg, "--horizon")) {
+                        params.horizon = strtoul(value, NULL, 0);
+                } else if (!strcmp(arg, "--policy") && policy_count < MAX_POLICIES) {
+                        if (parse_policy(value, &policies[policy_count++])) {
+                                fprintf(stderr, "Invalid policy %s\n", value);
+                                return 2;
+                        }
+                } else {
+                        usage(argv[0]);
+                        return 2;
+                }
+        }
+
+        if (params.scenarios <= 0) {
+                usage(argv[0]);
+                return 2;
+        }
+
+        // The firmware defaults
+        if (!policy_count)
+                parse_policy("2000:120000:10000:30000", &policies[policy_count++]);
+
+        uint32_t *ttc = malloc(params.scenarios * sizeof(uint32_t));
+        if (!ttc)
+                return 1;
+
+        printf("%-28s %7s %9s %9s %9s %9s %9s %9s %8s %8s %8s\n",
+               "policy", "failed", "p50 s", "p90 s", "p99 s", "max s", "attempts", "aborted",
+               "portals", "portal s", "runs/s");
+
+        for (int p = 0; p < policy_count; p++) {
+                const provision_config_t *policy = &policies[p];
+                int connected = 0;
+                uint64_t attempts = 0, interrupted = 0, portal_starts = 0, portal_time = 0;
+                sim_t sim;
+
+                clock_t started = clock();
+                for (int i = 0; i < params.scenarios; i++) {
+                        uint64_t seed = params.seed ^ ((uint64_t) i * 0x9e3779b97f4a7c15ULL);
+                        int64_t result = sim_run(&sim, &params, policy, seed);
+
+                        firmware_softap_stop(&sim);
+                        attempts += sim.attempts;
+                        interrupted += sim.interrupted;
+                        portal_starts += sim.portal_starts;
+                        portal_time += sim.portal_time;
+                        if (result >= 0)
+                                ttc[connected++] = result;
+                }
+                double elapsed = (double) (clock() - started) / CLOCKS_PER_SEC;
+
+                qsort(ttc, connected, sizeof(uint32_t), compare_u32);
+
+                char name[48];
+                snprintf(name, sizeof(name), "%u:%u:%u:%u", (unsigned) policy->backoff_min,
+                         (unsigned) policy->backoff_max, (unsigned) policy->disconnected_interval,
+                         (unsigned) policy->grace);
+                printf("%-28s %7d %9.1f %9.1f %9.1f %9.1f %9.1f %9.2f %8.2f %8.1f %8.0f\n",
+                       name, params.scenarios - connected,
+                       percentile(ttc, connected, 0.50) / 1000.0,
+                       percentile(ttc, connected, 0.90) / 1000.0,
+                       percentile(ttc, connected, 0.99) / 1000.0,
+                       connected ? ttc[connected - 1] / 1000.0 : 0.0,
+                       (double) attempts / params.scenarios,
+                       (double) interrupted / params.scenarios,
+                       (double) portal_starts / params.scenarios,
+                       (double) portal_time / params.scenarios / 1000.0,
+                       elapsed > 0 ? params.scenarios / elapsed : 0.0);
+        }
+
+        free(ttc);
+        return 0;
+}
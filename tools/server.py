@@ -1,7 +1,7 @@
 #!/usr/bin/env python
 
 from collections import namedtuple
-from flask import Flask, render_template, render_template_string, request
+from flask import Flask, jsonify, render_template, render_template_string, request
 import os
 import os.path
 import sys
@@ -74,14 +74,36 @@ def get_settings0():
     return _render_settings([])
 
 
+# Simulated trial connect: a network named "fail" is rejected
+trial = {'state': 'idle', 'reason': 0, 'polls': 0}
+
+
 @app.route('/settings', methods=['POST'])
 def update_settings():
-    if request.form.get('password'):
-        return 'Connecting to "%s", password = "%s"' % (
-            request.form['ssid'],
-            request.form['password']
-        )
-    return 'Connecting to "%s", no password' % request.form['ssid']
+    failed = request.form.get('ssid') == 'fail'
+    trial.update(state='connecting', reason=202 if failed else 0, polls=0,
+                 result='failed' if failed else 'connected')
+    return '', 202
+
+
+@app.route('/provision', methods=['POST'])
+def provision():
+    ssid = request.form.get('ssid', '')
+    if not ssid or len(ssid) > 32:
+        return 'ERR\n', 400, {'Content-Type': 'text/plain'}
+    failed = ssid == 'fail' and request.form.get('commit') != '1'
+    trial.update(state='connecting', reason=202 if failed else 0, polls=0,
+                 result='failed' if failed else 'connected')
+    return 'OK\n', 202, {'Content-Type': 'text/plain'}
+
+
+@app.route('/status', methods=['GET'])
+def get_status():
+    if trial['state'] == 'connecting':
+        trial['polls'] += 1
+        if trial['polls'] >= 3:
+            trial['state'] = trial['result']
+    return jsonify(state=trial['state'], reason=trial['reason'])
 
 
 # Server entry point
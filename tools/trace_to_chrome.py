@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import re
+import struct
+import sys
+
+# Converts a trace dump written by src/trace.c (firmware built with
+# WIFI_CONFIG_TRACE) into Chrome trace JSON, viewable in chrome://tracing
+# or https://ui.perfetto.dev. The dump is either the binary body of
+# GET /trace or a console log containing the hex lines printed by
+# wifi_config_trace_dump().
+
+TRACE_MAGIC = b'WCTR'
+TRACE_VERSION = 1
+
+HEADER = struct.Struct('<4sHHI')
+RECORD = struct.Struct('<qHBBI')
+
+
+def extract_console_dump(text):
+    match = re.search(r'WCTRACE BEGIN\s*\n(.*?)WCTRACE END', text, re.S)
+    if not match:
+        raise SystemExit("❌ No complete WCTRACE BEGIN/END block found in the log")
+
+    hex_lines = []
+    for line in match.group(1).splitlines():
+        # Keep only the hex payload in case the monitor prefixed the lines
+        found = re.search(r'([0-9a-f]+)\s*$', line)
+        if found:
+            hex_lines.append(found.group(1))
+    return bytes.fromhex(''.join(hex_lines))
+
+
+def parse_dump(data):
+    magic, version, name_count, record_count = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC or version != TRACE_VERSION:
+        raise SystemExit("❌ Not a version 1 trace dump")
+
+    offset = HEADER.size
+    names = []
+    for _ in range(name_count):
+        end = data.index(b'\0', offset)
+        names.append(data[offset:end].decode('ascii'))
+        offset = end + 1
+
+    records = []
+    for _ in range(record_count):
+        records.append(RECORD.unpack_from(data, offset))
+        offset += RECORD.size
+    return names, records
+
+
+def to_chrome_trace(names, records):
+    # Slots are claimed before they are stamped, so order by time
+    records = sorted(records, key=lambda record: record[0])
+    start = records[0][0] if records else 0
+
+    events = []
+    for timestamp, event, phase, core, arg in records:
+        name = names[event] if event < len(names) else f'event_{event}'
+        entry = {
+            'name': name,
+            'ph': chr(phase),
+            'ts': timestamp - start,
+            'pid': 1,
+            'tid': core,
+            'args': {'arg': arg},
+        }
+        if entry['ph'] == 'i':
+            entry['s'] = 't'
+        events.append(entry)
+
+    return {'traceEvents': events, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert a wifi_config trace dump to Chrome trace JSON')
+    parser.add_argument('input', help='binary dump from GET /trace, or a console log')
+    parser.add_argument('output', nargs='?', help='JSON file to write (default: stdout)')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    if b'WCTRACE BEGIN' in data:
+        data = extract_console_dump(data.decode('utf-8', errors='replace'))
+
+    names, records = parse_dump(data)
+    trace = to_chrome_trace(names, records)
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(trace, f)
+        print(f"✅ Generated: {args.output} ({len(records)} events)")
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()